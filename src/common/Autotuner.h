@@ -0,0 +1,138 @@
+// -*-c++-*-
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+// Online tuning of integer settings, such as the number of events in flight, for throughput.
+// The caller runs in periods (e.g. blocks of events) and reports after each one how many
+// events per second it got and whether it went over its latency or memory cap; the tuner
+// answers with the settings for the next period.
+//
+// Settings are tuned one at a time by hill climbing with additive steps: a setting keeps moving
+// in the same direction while throughput improves. Once it drops the step is undone, and the
+// setting tries the other direction, unless that is where it came from (or was already tried);
+// then it stays put for a period and the next setting gets its turn. Going over the cap halves
+// the current setting (the multiplicative decrease of AIMD), on the assumption that larger
+// settings buy throughput with latency and memory. Every change is logged, and print() reports
+// the best settings seen under the cap so they can be pinned.
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+namespace sch {
+struct TunedSetting {
+    std::string name;
+    std::size_t value;
+    std::size_t min;
+    std::size_t max;
+    std::size_t step;
+};
+
+class Autotuner {
+  private:
+    std::vector<TunedSetting> settings;
+    std::size_t current = 0; // Setting being tuned
+    int direction = 1;
+    // Whether the other direction of the current setting is known not to pay: it was tried, or
+    // the setting got to its value by improving on it
+    bool reverse_tried = false;
+    // Throughput of the values before the last step, if it is comparable
+    double baseline = 0;
+    bool have_baseline = false;
+    std::size_t last_value = 0; // Of the current setting, before the last step
+    double best_throughput = 0;
+    std::vector<std::size_t> best_values{};
+
+    // Moves the current setting by one step, turning round at its bounds
+    void step() {
+        TunedSetting& s = settings[current];
+        last_value = s.value;
+        if (direction > 0 ? s.value + s.step > s.max : s.value < s.min + s.step) {
+            direction = -direction;
+        }
+        s.value = direction > 0 ? std::min(s.max, s.value + s.step)
+                                : std::max(s.min, s.value - std::min(s.value, s.step));
+    }
+
+    void next_setting() {
+        current = (current + 1) % settings.size();
+        direction = 1;
+        reverse_tried = false;
+    }
+
+    std::vector<std::size_t> values() const {
+        std::vector<std::size_t> result{};
+        for (const auto& s : settings) {
+            result.push_back(s.value);
+        }
+        return result;
+    }
+
+  public:
+    explicit Autotuner(std::vector<TunedSetting> settings) : settings(std::move(settings)) {}
+
+    // Value of setting i for the coming period
+    std::size_t operator[](std::size_t i) const { return settings[i].value; }
+
+    // Reports the period just finished, run with the current values
+    void update(double throughput, bool over_cap) {
+        const auto before = values();
+        if (!over_cap && throughput > best_throughput) {
+            best_throughput = throughput;
+            best_values = before;
+        }
+        TunedSetting& s = settings[current];
+        if (over_cap) {
+            // The search starts again from the halved value, with a fresh baseline, going up:
+            // carrying on down would keep sinking the setting after it is back under the cap
+            s.value = std::max(s.min, s.value / 2);
+            last_value = s.value;
+            direction = 1;
+            reverse_tried = false;
+            have_baseline = false;
+        }
+        else if (have_baseline && throughput < baseline) {
+            // The last step did not pay: undo it, and step the other way from the baseline. If
+            // that did not pay either, the setting is at a peak: it stays there for a period,
+            // which also measures a fresh baseline, and then the next setting gets its turn.
+            s.value = last_value;
+            if (reverse_tried) {
+                next_setting();
+                have_baseline = false;
+            }
+            else {
+                direction = -direction;
+                reverse_tried = true;
+                step();
+            }
+        }
+        else {
+            // Going back would undo an improvement
+            reverse_tried = have_baseline;
+            baseline = throughput;
+            have_baseline = true;
+            step();
+        }
+        fmt::print("Autotune: {:.0f} events/s{} with {} -> {}\n", throughput,
+                   over_cap ? " (over cap)" : "", before, values());
+    }
+
+    void print() const {
+        if (best_values.empty()) {
+            fmt::print("Autotune: no period stayed under the cap\n");
+            return;
+        }
+        fmt::print("Autotune: best {:.0f} events/s with", best_throughput);
+        for (std::size_t i = 0; i < settings.size(); ++i) {
+            fmt::print(" {}={}", settings[i].name, best_values[i]);
+        }
+        fmt::print("\n");
+    }
+};
+} // namespace sch
+
+#endif /* AUTOTUNER_H */
@@ -0,0 +1,49 @@
+#ifndef EIGENMTRX_H_
+#define EIGENMTRX_H_
+// This defines an EigenMtrx type: same interface as CPUMtrx, but with compile-time dimensions
+// and the elements stored inline, so small matrices cost no heap allocation of their own and no
+// BLAS call overhead. Meant for sizes up to ~64; Eigen refuses to put much bigger fixed-size
+// matrices on the stack.
+
+#include <cstddef>
+#include <random>
+
+#include <Eigen/Dense>
+
+template <int Rows> class EigenMtrx {
+  private:
+    Eigen::Matrix<float, Rows, Rows> data;
+
+  public:
+    static constexpr int Size = Rows * Rows;
+
+    EigenMtrx() : data(Eigen::Matrix<float, Rows, Rows>::Zero()) {}
+    EigenMtrx(const EigenMtrx&) = delete;
+    EigenMtrx(EigenMtrx&&) = default;
+    // Same distribution as CPUMtrx: uniform in [1e-7, 1), times mult
+    EigenMtrx(long long mult) {
+        static thread_local std::mt19937 engine{777};
+        std::uniform_real_distribution<float> dist{1e-7f, 1.f};
+        const float mult_f = mult;
+        data = data.NullaryExpr([&]() { return dist(engine) * mult_f; });
+    }
+
+    EigenMtrx operator*(const EigenMtrx& rhs) {
+        EigenMtrx result{};
+        result.data.noalias() = data * rhs.data;
+        return result;
+    }
+
+    EigenMtrx operator+(const EigenMtrx& rhs) {
+        EigenMtrx result{};
+        result.data = data + rhs.data;
+        return result;
+    }
+
+    float norm() { return data.norm(); }
+
+    // Memory owned by this matrix, for the scheduler's accounting
+    std::size_t bytes() const { return sizeof(*this); }
+};
+
+#endif // EIGENMTRX_H_
@@ -0,0 +1,265 @@
+// -*-c++-*-
+#ifndef EVTCOLUMNS_H
+#define EVTCOLUMNS_H
+// Binary columnar event files. The schema is the member list of a hana-adapted struct
+// (BOOST_HANA_DEFINE_STRUCT or BOOST_HANA_ADAPT_STRUCT), so event contexts can be filled
+// straight from a memory mapping of the file.
+//
+// Layout (native endianness):
+//   FileHeader
+//   ColumnDesc x n_columns
+//   one 64-byte aligned array of n_rows values per column
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+
+#include <fmt/format.h>
+
+// For compile-time string literals
+#define BOOST_HANA_CONFIG_ENABLE_STRING_UDL
+#include <boost/hana.hpp>
+namespace hana = boost::hana;
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace sch::io {
+constexpr char columnar_magic[8] = {'E', 'V', 'T', 'C', 'O', 'L', '1', '\0'};
+constexpr std::size_t column_alignment = 64;
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t n_columns;
+    std::uint32_t reserved;
+    std::uint64_t n_rows;
+};
+
+enum class ColumnKind : std::uint32_t { Signed = 0, Unsigned = 1, Float = 2 };
+
+struct ColumnDesc {
+    char name[48];
+    std::uint32_t elem_size;
+    ColumnKind kind;
+    std::uint64_t offset; // from the start of the file
+};
+static_assert(sizeof(ColumnDesc) == 64, "ColumnDesc must stay 64 bytes");
+
+template <class T> constexpr ColumnKind kind_of() {
+    static_assert(std::is_arithmetic_v<T>, "Columnar event members must be arithmetic");
+    if constexpr (std::is_floating_point_v<T>) {
+        return ColumnKind::Float;
+    }
+    else if constexpr (std::is_signed_v<T>) {
+        return ColumnKind::Signed;
+    }
+    else {
+        return ColumnKind::Unsigned;
+    }
+}
+
+// Type of the member of Row called Name
+template <class Row, class Name>
+using member_t = std::remove_cv_t<std::remove_reference_t<decltype(hana::at_key(
+      std::declval<Row&>(), std::declval<Name>()))>>;
+
+inline std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + column_alignment - 1) / column_alignment * column_alignment;
+}
+
+// Writes rows as a columnar file with one column per member of Row
+template <class Row> void write_columns(const std::string& path, const std::vector<Row>& rows) {
+    constexpr auto accessors = hana::accessors<Row>();
+    constexpr std::size_t n_columns = hana::length(accessors);
+    FileHeader header{};
+    std::memcpy(header.magic, columnar_magic, sizeof(columnar_magic));
+    header.n_columns = n_columns;
+    header.n_rows = rows.size();
+
+    std::vector<ColumnDesc> descs{};
+    std::uint64_t offset = align_up(sizeof(FileHeader) + n_columns * sizeof(ColumnDesc));
+    hana::for_each(accessors, [&](auto&& acc) {
+        using T = std::remove_cv_t<std::remove_reference_t<decltype(hana::second(acc)(rows[0]))>>;
+        constexpr std::decay_t<decltype(hana::first(acc))> name{};
+        static_assert(hana::length(name) < sizeof(ColumnDesc::name), "Column name too long");
+        ColumnDesc desc{};
+        std::memcpy(desc.name, name.c_str(), hana::length(name));
+        desc.elem_size = sizeof(T);
+        desc.kind = kind_of<T>();
+        desc.offset = offset;
+        descs.push_back(desc);
+        offset = align_up(offset + rows.size() * sizeof(T));
+    });
+
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        throw std::runtime_error(fmt::format("Cannot open {} for writing", path));
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(descs.data()), descs.size() * sizeof(ColumnDesc));
+    std::size_t col = 0;
+    hana::for_each(accessors, [&](auto&& acc) {
+        using T = std::remove_cv_t<std::remove_reference_t<decltype(hana::second(acc)(rows[0]))>>;
+        std::vector<char> pad(descs[col].offset - out.tellp(), '\0');
+        out.write(pad.data(), pad.size());
+        std::vector<T> column{};
+        column.reserve(rows.size());
+        for (const auto& row : rows) {
+            column.push_back(hana::second(acc)(row));
+        }
+        out.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+        ++col;
+    });
+    if (!out) {
+        throw std::runtime_error(fmt::format("Failed writing {}", path));
+    }
+}
+
+// Reads whitespace-separated text rows, one value per member of Row in declaration order
+template <class Row> std::vector<Row> read_text_rows(std::istream& in) {
+    std::vector<Row> rows{};
+    while (true) {
+        Row row{};
+        hana::for_each(hana::accessors<Row>(), [&](auto&& acc) { in >> hana::second(acc)(row); });
+        if (in.fail()) {
+            break;
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+// Maps a columnar file read-only and checks it against the members of EC: every member needs
+// a column with the same name, size and kind. Rows are never parsed; load() assigns one row
+// straight from the mapping to the members of an event context, which is where the nodes read
+// their inputs from.
+template <class EC> class MappedColumns {
+  private:
+    static constexpr auto accessors = hana::accessors<EC>();
+    static constexpr std::size_t n_members = hana::length(accessors);
+
+    const char* base = nullptr;
+    std::size_t length = 0;
+    std::size_t n_rows = 0;
+    std::uint64_t offsets[n_members]{};
+
+  public:
+    explicit MappedColumns(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(fmt::format("Cannot open {}", path));
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+            ::close(fd);
+            throw std::runtime_error(fmt::format("{} is not a columnar event file", path));
+        }
+        length = st.st_size;
+        void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error(fmt::format("Cannot map {}", path));
+        }
+        base = static_cast<const char*>(mapping);
+        validate(path);
+    }
+    MappedColumns(const MappedColumns&) = delete;
+    MappedColumns& operator=(const MappedColumns&) = delete;
+    ~MappedColumns() {
+        if (base) {
+            ::munmap(const_cast<char*>(base), length);
+        }
+    }
+
+    std::size_t size() const { return n_rows; }
+
+    void load(EC& ec, std::size_t row) const {
+        hana::for_each(hana::make_range(hana::size_c<0>, hana::size_c<n_members>), [&](auto i) {
+            auto& member = hana::second(hana::at(accessors, i))(ec);
+            using T = std::remove_reference_t<decltype(member)>;
+            member = reinterpret_cast<const T*>(base + offsets[i])[row];
+        });
+    }
+
+  private:
+    void validate(const std::string& path) {
+        FileHeader header{};
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, columnar_magic, sizeof(columnar_magic)) != 0) {
+            throw std::runtime_error(fmt::format("{} is not a columnar event file", path));
+        }
+        if (sizeof(FileHeader) + header.n_columns * sizeof(ColumnDesc) > length) {
+            throw std::runtime_error(fmt::format("{} is truncated", path));
+        }
+        n_rows = header.n_rows;
+        const auto* descs = reinterpret_cast<const ColumnDesc*>(base + sizeof(FileHeader));
+        hana::for_each(hana::make_range(hana::size_c<0>, hana::size_c<n_members>), [&](auto i) {
+            constexpr std::decay_t<decltype(hana::first(hana::at(accessors, i)))> name{};
+            using T = member_t<EC, decltype(name)>;
+            const ColumnDesc* found = nullptr;
+            for (std::uint32_t c = 0; c < header.n_columns; ++c) {
+                // The name is not NUL-terminated if it fills the field (or the file is corrupt)
+                const std::string_view desc_name{descs[c].name,
+                                                 strnlen(descs[c].name, sizeof descs[c].name)};
+                if (desc_name == name.c_str()) {
+                    found = &descs[c];
+                }
+            }
+            if (!found || found->elem_size != sizeof(T) || found->kind != kind_of<T>()) {
+                throw std::runtime_error(
+                      fmt::format("{} has no column matching member {}", path, name.c_str()));
+            }
+            // Written so that a huge n_rows or offset cannot overflow the check
+            if (found->offset % alignof(T) != 0 || found->offset > length
+                || n_rows > (length - found->offset) / sizeof(T)) {
+                throw std::runtime_error(
+                      fmt::format("Column {} of {} is out of bounds", name.c_str(), path));
+            }
+            offsets[i] = found->offset;
+        });
+    }
+};
+
+// Reads the event templates used by the mains from either a text file (as in test/test.txt) or,
+// when the path ends in ".evtc", a columnar file
+template <class EC> class EventReader {
+  private:
+    std::ifstream text{};
+    std::unique_ptr<MappedColumns<EC>> columns{};
+    std::size_t row = 0;
+
+  public:
+    explicit EventReader(const std::string& path) {
+        if (std::string_view{path}.size() >= 5
+            && std::string_view{path}.substr(path.size() - 5) == ".evtc") {
+            columns = std::make_unique<MappedColumns<EC>>(path);
+        }
+        else {
+            text.open(path);
+        }
+    }
+
+    // Fills the input members of ec from the next row; false once the input is exhausted
+    bool next(EC& ec) {
+        if (columns) {
+            if (row >= columns->size()) {
+                return false;
+            }
+            columns->load(ec, row++);
+            return true;
+        }
+        hana::for_each(hana::accessors<EC>(), [&](auto&& acc) { text >> hana::second(acc)(ec); });
+        return !text.fail();
+    }
+};
+} // namespace sch::io
+
+#endif /* EVTCOLUMNS_H */
@@ -0,0 +1,106 @@
+// -*-c++-*-
+#ifndef EVTPOOL_H
+#define EVTPOOL_H
+// Fixed-capacity ring of event contexts, so long runs reuse the same few contexts (and whatever
+// per-event state the scheduler keeps in them) instead of growing a std::deque without bound
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+// For compile-time string literals
+#define BOOST_HANA_CONFIG_ENABLE_STRING_UDL
+#include <boost/hana.hpp>
+namespace hana = boost::hana;
+
+namespace sch {
+// Copies only the inputs (the hana-adapted members) of src into dst, leaving the scheduler
+// state of dst alone
+template <class EC> void assign_inputs(EC& dst, const EC& src) {
+    hana::for_each(hana::accessors<EC>(),
+                   [&](auto&& acc) { hana::second(acc)(dst) = hana::second(acc)(src); });
+}
+
+// Slots are handed out in submission order, so the capacity bounds the number of events in
+// flight; set_limit() lowers that bound at run time without reallocating. A slot is free again
+// once release() is called for it. If acquire() needs a slot that is still in use, or the limit
+// is reached, it first calls consume(ec) for the oldest event in flight, which must wait for
+// that event's outputs and read them. Either way, the slot is reset in place with ec.reset()
+// before being reused.
+template <class EC> class EvtPool {
+  private:
+    // Each context on its own cache lines, so workers finishing neighbouring events do not
+    // share lines
+    struct alignas(64) Slot {
+        EC ec{};
+        bool busy{false};
+    };
+    std::size_t capacity;
+    std::size_t max_in_flight;
+    std::unique_ptr<Slot[]> slots;
+    std::size_t next = 0;
+    std::size_t in_flight = 0;
+
+    // The slot after the last one handed out is the least recently acquired
+    template <class Consume> void retire_oldest(Consume&& consume) {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            Slot& slot = slots[(next + i) % capacity];
+            if (slot.busy) {
+                consume(slot.ec);
+                slot.ec.reset();
+                slot.busy = false;
+                --in_flight;
+                return;
+            }
+        }
+    }
+
+  public:
+    explicit EvtPool(std::size_t capacity)
+          : capacity(capacity), max_in_flight(capacity),
+            slots(std::make_unique<Slot[]>(capacity)) {}
+    EvtPool(const EvtPool&) = delete;
+    EvtPool& operator=(const EvtPool&) = delete;
+
+    std::size_t size() const { return capacity; }
+    std::size_t limit() const { return max_in_flight; }
+    // Takes effect from the next acquire()
+    void set_limit(std::size_t n) { max_in_flight = std::clamp<std::size_t>(n, 1, capacity); }
+
+    template <class Consume> EC& acquire(Consume&& consume) {
+        while (in_flight >= max_in_flight || slots[next].busy) {
+            retire_oldest(consume);
+        }
+        Slot& slot = slots[next];
+        next = (next + 1) % capacity;
+        slot.busy = true;
+        ++in_flight;
+        return slot.ec;
+    }
+
+    void release(EC& ec) {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            if (&slots[i].ec == &ec && slots[i].busy) {
+                ec.reset();
+                slots[i].busy = false;
+                --in_flight;
+            }
+        }
+    }
+
+    // Consumes every event still in flight, oldest first
+    template <class Consume> void consume_all(Consume&& consume) {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            Slot& slot = slots[(next + i) % capacity];
+            if (slot.busy) {
+                consume(slot.ec);
+                slot.ec.reset();
+                slot.busy = false;
+            }
+        }
+        in_flight = 0;
+    }
+};
+} // namespace sch
+
+#endif /* EVTPOOL_H */
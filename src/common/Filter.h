@@ -0,0 +1,42 @@
+// -*-c++-*-
+#ifndef FILTER_H
+#define FILTER_H
+// Filter nodes. A node whose function returns std::optional is a filter: an empty value rejects
+// the event, e.g.
+//   std::optional<long long> select(long long x) { if (x < cut) return {}; return x; }
+// Nodes reading a filter, directly or through other nodes, are gated: they take the plain value,
+// are skipped when any of their inputs is empty, and hold an empty std::optional themselves.
+// Retrieving a gated node gives a std::optional, empty for rejected events.
+
+#include <optional>
+#include <type_traits>
+
+namespace sch {
+template <class T> struct is_optional : std::false_type {};
+template <class T> struct is_optional<std::optional<T>> : std::true_type {};
+template <class T> constexpr bool is_optional_v = is_optional<T>::value;
+
+// Value held by a node that can be empty
+template <class T> using maybe_t = std::conditional_t<is_optional_v<T>, T, std::optional<T>>;
+
+// Whether an input value lets the node run
+template <class T> constexpr bool present(const T&) { return true; }
+template <class T> constexpr bool present(const std::optional<T>& value) {
+    return value.has_value();
+}
+
+// The value a node's function takes, from a present input
+template <class T> constexpr const T& unwrap(const T& value) { return value; }
+template <class T> constexpr const T& unwrap(const std::optional<T>& value) { return *value; }
+
+// Memory a value owns, for the scheduler to free: the pointer of a (present) pointer value
+template <class T> constexpr T* owned_ptr(T* value) { return value; }
+template <class T> constexpr T* owned_ptr(const std::optional<T*>& value) {
+    return value.value_or(nullptr);
+}
+template <class T> struct owns_memory : std::is_pointer<T> {};
+template <class T> struct owns_memory<std::optional<T>> : std::is_pointer<T> {};
+template <class T> constexpr bool owns_memory_v = owns_memory<T>::value;
+} // namespace sch
+
+#endif /* FILTER_H */
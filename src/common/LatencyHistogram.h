@@ -0,0 +1,107 @@
+// -*-c++-*-
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+// Lock-free histogram of latencies, laid out like HdrHistogram: values below 2^sub_bits
+// nanoseconds get a bucket each, and every power of two above that is split into 2^sub_bits
+// linear buckets, so a reported percentile is within 1/2^sub_bits (about 3%) of the true one.
+// Recording is a few relaxed atomic adds, so workers record while the main thread reports.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <fmt/format.h>
+
+namespace sch {
+class LatencyHistogram {
+  private:
+    static constexpr unsigned sub_bits = 5;
+    static constexpr std::uint64_t sub_count = std::uint64_t{1} << sub_bits;
+    // Octaves above the linear range; latencies of 2^40 ns (about 18 minutes) or more are
+    // counted in the last bucket
+    static constexpr unsigned n_octaves = 40 - sub_bits;
+    static constexpr std::size_t n_buckets = (n_octaves + 1) * sub_count;
+
+    std::array<std::atomic<std::uint64_t>, n_buckets> counts{};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> max_ns{0};
+
+    static std::size_t bucket_of(std::uint64_t ns) {
+        if (ns < sub_count) {
+            return ns;
+        }
+        const unsigned shift = 63 - __builtin_clzll(ns) - sub_bits;
+        if (shift >= n_octaves) {
+            return n_buckets - 1;
+        }
+        return (shift + 1) * sub_count + ((ns >> shift) - sub_count);
+    }
+    // Largest value counted in bucket b
+    static std::uint64_t highest_in(std::size_t b) {
+        if (b < sub_count) {
+            return b;
+        }
+        const unsigned shift = b / sub_count - 1;
+        return ((sub_count + b % sub_count + 1) << shift) - 1;
+    }
+
+  public:
+    void record(std::chrono::nanoseconds latency) {
+        const std::uint64_t ns = latency.count() > 0 ? latency.count() : 0;
+        counts[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t old_max = max_ns.load(std::memory_order_relaxed);
+        while (ns > old_max
+               && !max_ns.compare_exchange_weak(old_max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    std::chrono::nanoseconds max() const { return std::chrono::nanoseconds(max_ns.load()); }
+
+    // Bucket counts, to measure an interval with percentile(q, since)
+    using Counts = std::array<std::uint64_t, n_buckets>;
+    Counts snapshot() const {
+        Counts result{};
+        for (std::size_t b = 0; b < n_buckets; ++b) {
+            result[b] = counts[b].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // Smallest latency that at least a fraction q of the ones recorded since the snapshot do
+    // not exceed. Recording may go on meanwhile, in which case the answer is for some mix of
+    // before and after.
+    std::chrono::nanoseconds percentile(double q, const Counts& since) const {
+        Counts now = snapshot();
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < n_buckets; ++b) {
+            now[b] -= since[b];
+            seen += now[b];
+        }
+        const auto rank = static_cast<std::uint64_t>(q * seen + 0.5);
+        std::uint64_t below = 0;
+        for (std::size_t b = 0; b < n_buckets; ++b) {
+            below += now[b];
+            if (below >= rank && below > 0) {
+                return std::chrono::nanoseconds(std::min(highest_in(b), max_ns.load()));
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+    // ... of all the recorded latencies
+    std::chrono::nanoseconds percentile(double q) const { return percentile(q, Counts{}); }
+
+    void print(const char* label) const {
+        constexpr double ms = 1e6;
+        fmt::print("{}: {} events, p50 {:.3f} ms, p99 {:.3f} ms, p99.9 {:.3f} ms, max {:.3f} ms\n",
+                   label, count(), percentile(0.5).count() / ms, percentile(0.99).count() / ms,
+                   percentile(0.999).count() / ms, max().count() / ms);
+    }
+};
+} // namespace sch
+
+#endif /* LATENCYHISTOGRAM_H */
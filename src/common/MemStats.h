@@ -0,0 +1,95 @@
+// -*-c++-*-
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+// Live memory of the intermediates a scheduler holds, per node and in total, and the number of
+// events in flight, with their peaks. Value types opt in by having a bytes() member returning
+// how much memory a value owns; pointers and shared_ptrs to such types count what they point
+// to. Everything else counts as zero.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include <fmt/format.h>
+
+namespace sch {
+template <class T, class = void> struct has_bytes : std::false_type {};
+template <class T>
+struct has_bytes<T, std::void_t<decltype(std::declval<const T&>().bytes())>> : std::true_type {};
+
+template <class T> std::size_t bytes_of(const T& value) {
+    if constexpr (has_bytes<T>::value) {
+        return value.bytes();
+    }
+    else if constexpr (std::is_pointer_v<T>) {
+        return value ? bytes_of(*value) : 0;
+    }
+    else {
+        return 0;
+    }
+}
+template <class T> std::size_t bytes_of(const std::shared_ptr<T>& value) {
+    return value ? bytes_of(*value) : 0;
+}
+
+template <std::size_t N> class MemStats {
+  private:
+    struct alignas(64) Gauge {
+        std::atomic<std::int64_t> live{0};
+        std::atomic<std::int64_t> peak{0};
+
+        void add(std::int64_t delta) {
+            const std::int64_t now = live.fetch_add(delta, std::memory_order_relaxed) + delta;
+            std::int64_t old_peak = peak.load(std::memory_order_relaxed);
+            while (now > old_peak
+                   && !peak.compare_exchange_weak(old_peak, now, std::memory_order_relaxed)) {
+            }
+        }
+    };
+    std::array<Gauge, N> node_bytes{};
+    Gauge total_bytes{};
+    Gauge events{};
+
+  public:
+    // Node k produced (or freed) an intermediate owning bytes
+    void produced(std::size_t k, std::size_t bytes) {
+        if (bytes) {
+            node_bytes[k].add(bytes);
+            total_bytes.add(bytes);
+        }
+    }
+    void released(std::size_t k, std::size_t bytes) {
+        if (bytes) {
+            node_bytes[k].add(-static_cast<std::int64_t>(bytes));
+            total_bytes.add(-static_cast<std::int64_t>(bytes));
+        }
+    }
+    void events_started(std::size_t n = 1) { events.add(n); }
+    void events_finished(std::size_t n = 1) { events.add(-static_cast<std::int64_t>(n)); }
+
+    std::int64_t live_bytes() const { return total_bytes.live.load(); }
+    std::int64_t peak_bytes() const { return total_bytes.peak.load(); }
+    std::int64_t events_in_flight() const { return events.live.load(); }
+    std::int64_t peak_events_in_flight() const { return events.peak.load(); }
+
+    // names[k] is the name of node k
+    template <class Names> void print(const Names& names) const {
+        constexpr double MiB = 1024. * 1024.;
+        fmt::print("Intermediates: {:.1f} MiB live, {:.1f} MiB peak; events in flight: {} live, "
+                   "{} peak\n",
+                   live_bytes() / MiB, peak_bytes() / MiB, events_in_flight(),
+                   peak_events_in_flight());
+        for (std::size_t k = 0; k < N; ++k) {
+            if (node_bytes[k].peak.load() > 0) {
+                fmt::print("{:>16}: {:>10.1f} MiB live {:>10.1f} MiB peak\n", names[k],
+                           node_bytes[k].live.load() / MiB, node_bytes[k].peak.load() / MiB);
+            }
+        }
+    }
+};
+} // namespace sch
+
+#endif /* MEMSTATS_H */
@@ -0,0 +1,115 @@
+// -*-c++-*-
+#ifndef NODEOPTS_H
+#define NODEOPTS_H
+// Per-node settings, passed to Define after the function, e.g.
+//   sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times, sch::cost(50))
+// Backends ignore the settings they have no use for.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace sch {
+struct NodeOpts {
+    double cost = 1;            // Relative cost, used to find the critical path
+    const char* pool = nullptr; // HPX thread pool to run on, if not the default one
+    bool pure = false;          // No side effects, so running it twice is harmless
+    std::size_t grain = 1024;   // Fewest elements a map or reduce node gives one task
+};
+
+// Relative cost of the node (default 1)
+constexpr auto cost(double c) {
+    return [c](NodeOpts& opts) { opts.cost = c; };
+}
+
+// Runs the node on the named HPX thread pool, when the resource partitioner set one up
+constexpr auto pool(const char* name) {
+    return [name](NodeOpts& opts) { opts.pool = name; };
+}
+
+// Marks the node free of side effects, which lets the scheduler start a backup copy of it
+constexpr auto pure() {
+    return [](NodeOpts& opts) { opts.pure = true; };
+}
+
+// Fewest elements of its collection a map or reduce node gives one task (default 1024). Lower it
+// for expensive elements.
+constexpr auto grain(std::size_t n) {
+    return [n](NodeOpts& opts) { opts.grain = n; };
+}
+
+template <class... Opts> NodeOpts make_node_opts(Opts... opts) {
+    NodeOpts result{};
+    (opts(result), ...);
+    return result;
+}
+
+// Elements per task for a map or reduce node over n elements: at least grain, and otherwise
+// about four tasks per thread. A collection of up to one chunk is done in the node's own task.
+inline std::size_t chunk_size(std::size_t n, std::size_t grain, std::size_t n_threads) {
+    const std::size_t n_tasks = 4 * std::max<std::size_t>(n_threads, 1);
+    return std::max({grain, (n + n_tasks - 1) / n_tasks, std::size_t{1}});
+}
+
+// What the graph algorithms below need to know about a graph of N nodes. inputs[k] lists the
+// nodes (not event inputs) that node k reads.
+template <std::size_t N> struct GraphShape {
+    std::array<double, N> costs{};
+    std::array<std::vector<std::size_t>, N> inputs{};
+    std::array<bool, N> required{};
+};
+
+// Nodes that are required or upstream of a required node
+template <std::size_t N> std::array<bool, N> needed_nodes(const GraphShape<N>& shape) {
+    std::array<bool, N> needed = shape.required;
+    for (std::size_t pass = 0; pass < N; ++pass) {
+        for (std::size_t k = 0; k < N; ++k) {
+            if (needed[k]) {
+                for (auto in : shape.inputs[k]) {
+                    needed[in] = true;
+                }
+            }
+        }
+    }
+    return needed;
+}
+
+// Finds the nodes on the critical path of the subgraph needed for the required nodes. A node is
+// critical if the longest cost-weighted chain from an input through it to a required node is as
+// long as the longest chain of the whole subgraph.
+template <std::size_t N> std::array<bool, N> critical_nodes(const GraphShape<N>& shape) {
+    const auto& costs = shape.costs;
+    const auto& inputs = shape.inputs;
+    auto needed = needed_nodes(shape);
+    // top[k]: longest chain ending just before k; bottom[k]: longest chain from k to a required
+    // node, including k. Relaxing N times is enough for an acyclic graph of N nodes.
+    std::array<double, N> top{};
+    std::array<double, N> bottom{};
+    for (std::size_t pass = 0; pass < N; ++pass) {
+        for (std::size_t k = 0; k < N; ++k) {
+            if (!needed[k]) {
+                continue;
+            }
+            bottom[k] = std::max(bottom[k], costs[k]);
+            for (auto in : inputs[k]) {
+                top[k] = std::max(top[k], top[in] + costs[in]);
+                bottom[in] = std::max(bottom[in], costs[in] + bottom[k]);
+            }
+        }
+    }
+    double longest = 0;
+    for (std::size_t k = 0; k < N; ++k) {
+        if (needed[k]) {
+            longest = std::max(longest, top[k] + bottom[k]);
+        }
+    }
+    std::array<bool, N> critical{};
+    for (std::size_t k = 0; k < N; ++k) {
+        critical[k] = needed[k] && top[k] + bottom[k] >= longest * (1 - 1e-9);
+    }
+    return critical;
+}
+} // namespace sch
+
+#endif /* NODEOPTS_H */
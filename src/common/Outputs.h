@@ -0,0 +1,52 @@
+// -*-c++-*-
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+// Nodes with several outputs. A node whose function returns a std::tuple has one output per
+// element, and other nodes can read them one at a time, e.g. for the norms of the sum and the
+// product of two matrices computed in one pass over them:
+//   sch::Define("Norms"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus_and_times),
+//   sch::Define("Square Plus"_s, hana::make_tuple(sch::out<0>("Norms"_s)), square),
+// The node's value is the whole tuple, which is what its slot holds if it is retrieved. Reading
+// an output takes no task of its own: the element is picked out when the reading node runs.
+// The scheduler does not free pointers inside tuples, so outputs owning memory should be smart
+// pointers.
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+
+namespace sch {
+template <class Key, std::size_t I> struct Output {
+    static constexpr std::size_t index = I;
+};
+
+// Output I of node key, as an input of another node
+template <std::size_t I, class Key> constexpr Output<Key, I> out(Key) { return {}; }
+
+template <class In> struct is_output : std::false_type {};
+template <class Key, std::size_t I> struct is_output<Output<Key, I>> : std::true_type {};
+template <class In> constexpr bool is_output_v = is_output<In>::value;
+
+// Node (or event input) an input reads the value of
+template <class In> struct source { using type = In; };
+template <class Key, std::size_t I> struct source<Output<Key, I>> { using type = Key; };
+template <class In> using source_t = typename source<In>::type;
+
+// The part of its source's value that an input is
+template <class In, class T> constexpr decltype(auto) pick(const T& value) {
+    if constexpr (is_output_v<In>) {
+        return std::get<In::index>(value);
+    }
+    else {
+        return value;
+    }
+}
+
+// func, taking the values of the sources of inputs (a tuple of them, e.g. a hana::tuple)
+template <template <class...> class Tuple, class... In, class Func>
+auto pick_inputs(const Tuple<In...>&, Func func) {
+    return [func](const auto&... values) { return func(pick<In>(values)...); };
+}
+} // namespace sch
+
+#endif /* OUTPUTS_H */
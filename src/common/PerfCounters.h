@@ -0,0 +1,232 @@
+// -*-c++-*-
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+// Hardware performance counters per node type, through perf_event_open. Each thread opens one
+// group (cycles, instructions, LLC misses, dTLB misses) for itself the first time it measures
+// something, and reads it with rdpmc from the mapped counter pages when the kernel allows user
+// space to (cap_user_rdpmc), falling back to a read() of the group otherwise. If perf events
+// are not available at all (e.g. perf_event_paranoid, containers, no PMU in the VM) the counts
+// simply stay at zero and the summary says so.
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace sch::perf {
+enum Event { Cycles = 0, Instructions, LLCMisses, DTLBMisses, n_events };
+constexpr std::array<std::string_view, n_events> event_names = {"cycles", "instructions",
+                                                                 "LLC misses", "dTLB misses"};
+using Sample = std::array<std::uint64_t, n_events>;
+
+inline Sample operator-(const Sample& a, const Sample& b) {
+    Sample result{};
+    for (int e = 0; e < n_events; ++e) {
+        result[e] = a[e] - b[e];
+    }
+    return result;
+}
+
+// The counters of the calling thread
+class ThreadCounters {
+  private:
+    std::array<int, n_events> fds{-1, -1, -1, -1};
+    std::array<perf_event_mmap_page*, n_events> pages{};
+    bool any_open = false;
+
+    static perf_event_attr attr_for(Event e) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.exclude_kernel = 1; // Allowed with perf_event_paranoid up to 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        switch (e) {
+        case Cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case Instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case LLCMisses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        }
+        return attr;
+    }
+
+    ThreadCounters() {
+        for (int e = 0; e < n_events; ++e) {
+            perf_event_attr attr = attr_for(static_cast<Event>(e));
+            // Cycles lead the group, so the counters are scheduled on the PMU together
+            fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, e == Cycles ? -1 : fds[Cycles], 0);
+            if (fds[e] < 0) {
+                if (e == Cycles) {
+                    return; // No group, nothing else can be opened
+                }
+                continue; // This event is not supported here; keep the others
+            }
+            any_open = true;
+            void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fds[e], 0);
+            pages[e] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+        }
+    }
+
+    // Reads one counter without a syscall; false if the kernel does not allow it right now
+    bool read_rdpmc(int e, std::uint64_t& value) const {
+#if defined(__x86_64__)
+        const perf_event_mmap_page* page = pages[e];
+        if (!page) {
+            return false;
+        }
+        std::uint32_t seq;
+        do {
+            seq = page->lock;
+            std::atomic_signal_fence(std::memory_order_acq_rel);
+            const std::uint32_t index = page->index;
+            if (!page->cap_user_rdpmc || index == 0) {
+                return false;
+            }
+            std::int64_t count = page->offset;
+            std::uint64_t pmc = __builtin_ia32_rdpmc(index - 1);
+            const int shift = 64 - page->pmc_width;
+            count += static_cast<std::int64_t>(pmc << shift) >> shift; // Sign-extend
+            value = count;
+            std::atomic_signal_fence(std::memory_order_acq_rel);
+        } while (page->lock != seq);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+  public:
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+    ~ThreadCounters() {
+        for (int e = 0; e < n_events; ++e) {
+            if (pages[e]) {
+                munmap(pages[e], sysconf(_SC_PAGESIZE));
+            }
+            if (fds[e] >= 0) {
+                close(fds[e]);
+            }
+        }
+    }
+
+    // Not inlined, so the thread_local is looked up again at every call: an HPX task that
+    // suspends can resume on another worker, and a cached address would be the old thread's
+    [[gnu::noinline]] static ThreadCounters& get() {
+        static thread_local ThreadCounters counters{};
+        return counters;
+    }
+
+    bool available() const { return any_open; }
+
+    Sample read() const {
+        Sample sample{};
+        if (!any_open) {
+            return sample;
+        }
+        bool all_rdpmc = true;
+        for (int e = 0; e < n_events && all_rdpmc; ++e) {
+            all_rdpmc = fds[e] < 0 || read_rdpmc(e, sample[e]);
+        }
+        if (all_rdpmc) {
+            return sample;
+        }
+        // One syscall for the whole group: {nr, value of each open counter in order}
+        std::uint64_t buffer[1 + n_events] = {};
+        sample = Sample{};
+        if (::read(fds[Cycles], buffer, sizeof(buffer)) > 0) {
+            std::uint64_t i = 1;
+            for (int e = 0; e < n_events && i <= buffer[0]; ++e) {
+                if (fds[e] >= 0) {
+                    sample[e] = buffer[i++];
+                }
+            }
+        }
+        return sample;
+    }
+};
+
+// Totals per node of a graph with N nodes, updated concurrently by the workers
+template <std::size_t N> class NodeCounters {
+  private:
+    struct alignas(64) Totals {
+        std::atomic<std::uint64_t> runs{0};
+        std::array<std::atomic<std::uint64_t>, n_events> counts{};
+    };
+    std::array<Totals, N> totals{};
+    std::atomic<bool> measured{false};
+    std::atomic<std::uint64_t> dropped{0};
+
+  public:
+    // Runs func(), charging the counter deltas to node k. A run that ends on another thread than
+    // it started on (the task suspended, e.g. waiting on a batched product, and resumed
+    // elsewhere) is not counted: the counters read afterwards are not the ones read before.
+    template <class Func> decltype(auto) measure(std::size_t k, Func&& func) {
+        const ThreadCounters& counters = ThreadCounters::get();
+        if (counters.available()) {
+            measured.store(true, std::memory_order_relaxed);
+        }
+        const Sample before = counters.read();
+        decltype(auto) result = func();
+        if (&ThreadCounters::get() != &counters) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+        const Sample delta = counters.read() - before;
+        totals[k].runs.fetch_add(1, std::memory_order_relaxed);
+        for (int e = 0; e < n_events; ++e) {
+            totals[k].counts[e].fetch_add(delta[e], std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // names[k] is the name of node k
+    template <class Names> void print(const Names& names) const {
+        if (!measured.load()) {
+            fmt::print("Hardware counters unavailable (check perf_event_paranoid)\n");
+            return;
+        }
+        fmt::print("{:>16} {:>8} {:>14} {:>14} {:>6} {:>12} {:>12}\n", "Node", "runs",
+                   event_names[Cycles], event_names[Instructions], "IPC", event_names[LLCMisses],
+                   event_names[DTLBMisses]);
+        for (std::size_t k = 0; k < N; ++k) {
+            const std::uint64_t runs = totals[k].runs.load();
+            if (runs == 0) {
+                continue;
+            }
+            auto per_run = [&](Event e) { return totals[k].counts[e].load() / runs; };
+            const double ipc = per_run(Cycles) ? double(per_run(Instructions)) / per_run(Cycles)
+                                               : 0.;
+            fmt::print("{:>16} {:>8} {:>14} {:>14} {:>6.2f} {:>12} {:>12}\n", names[k], runs,
+                       per_run(Cycles), per_run(Instructions), ipc, per_run(LLCMisses),
+                       per_run(DTLBMisses));
+        }
+        fmt::print("(per run averages)\n");
+        if (const std::uint64_t n = dropped.load()) {
+            fmt::print("({} runs resumed on another thread were not counted)\n", n);
+        }
+    }
+};
+} // namespace sch::perf
+
+#endif /* PERFCOUNTERS_H */
@@ -0,0 +1,202 @@
+#ifndef REDUCEDPRECISION_H_
+#define REDUCEDPRECISION_H_
+// 16-bit float storage types (bfloat16 and IEEE half) and the element-wise kernels the matrix
+// types need, all computing in fp32. Conversions use AVX-512 BF16 / AVX-512F for bfloat16 and
+// F16C for half when the compiler targets them (-march=native), with portable scalar fallbacks.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace lowp {
+struct bf16 {
+    std::uint16_t bits;
+};
+struct fp16 {
+    std::uint16_t bits;
+};
+
+// Scalar conversions, rounding to nearest even
+inline float to_float(bf16 x) {
+    std::uint32_t bits = std::uint32_t{x.bits} << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline bf16 from_float(float f, bf16) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+        return {static_cast<std::uint16_t>((bits >> 16) | 0x40)}; // Keep NaNs quiet
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1);
+    return {static_cast<std::uint16_t>(bits >> 16)};
+}
+
+inline float to_float(fp16 x) {
+    const std::uint32_t sign = std::uint32_t{x.bits & 0x8000u} << 16;
+    std::uint32_t exp = (x.bits >> 10) & 0x1f;
+    std::uint32_t man = x.bits & 0x3ff;
+    std::uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000u | (man << 13);
+    }
+    else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (man << 13);
+    }
+    else if (man == 0) {
+        bits = sign;
+    }
+    else {
+        // Subnormal: normalise the mantissa
+        exp = 113;
+        while (!(man & 0x400)) {
+            man <<= 1;
+            --exp;
+        }
+        bits = sign | (exp << 23) | ((man & 0x3ff) << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline fp16 from_float(float f, fp16) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const std::uint32_t sign = (bits >> 16) & 0x8000u;
+    const std::uint32_t mag = bits & 0x7fffffffu;
+    if (mag >= 0x7f800000u) {
+        return {static_cast<std::uint16_t>(sign | 0x7c00u | (mag > 0x7f800000u ? 0x200u : 0))};
+    }
+    if (mag >= 0x477ff000u) {
+        return {static_cast<std::uint16_t>(sign | 0x7c00u)}; // Rounds past 65504
+    }
+    if (mag < 0x38800000u) {
+        // Subnormal in half precision
+        const std::uint32_t shift = 126 - (mag >> 23);
+        if (shift > 24) {
+            return {static_cast<std::uint16_t>(sign)};
+        }
+        const std::uint32_t man = (mag & 0x7fffffu) | 0x800000u;
+        std::uint32_t result = man >> shift;
+        const std::uint32_t rest = man & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (result & 1))) {
+            ++result;
+        }
+        return {static_cast<std::uint16_t>(sign | result)};
+    }
+    std::uint32_t result = mag - 0x38000000u; // Rebias the exponent from 127 to 15
+    result += 0xfffu + ((result >> 13) & 1);
+    return {static_cast<std::uint16_t>(sign | (result >> 13))};
+}
+
+// Bulk conversions
+inline void to_float(const bf16* src, float* dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__AVX512F__)
+    for (; n - i >= 16; i += 16) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + i)));
+        _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16)));
+    }
+#elif defined(__AVX2__)
+    for (; n - i >= 8; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
+
+inline void from_float(const float* src, bf16* dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__AVX512BF16__)
+    for (; n - i >= 16; i += 16) {
+        __m256bh narrow = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), (__m256i)narrow);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = from_float(src[i], bf16{});
+    }
+}
+
+inline void to_float(const fp16* src, float* dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__F16C__)
+    for (; n - i >= 8; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
+
+inline void from_float(const float* src, fp16* dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__F16C__)
+    for (; n - i >= 8; i += 8) {
+        __m128i narrow = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), narrow);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = from_float(src[i], fp16{});
+    }
+}
+
+// Element-wise kernels, converting through small fp32 blocks that stay in L1
+constexpr std::size_t block = 256;
+
+// out = x + y
+template <class T> void add(const T* x, const T* y, T* out, std::size_t n) {
+    float fx[block];
+    float fy[block];
+    for (std::size_t i = 0; i < n; i += block) {
+        const std::size_t len = n - i < block ? n - i : block;
+        to_float(x + i, fx, len);
+        to_float(y + i, fy, len);
+        for (std::size_t j = 0; j < len; ++j) {
+            fx[j] += fy[j];
+        }
+        from_float(fx, out + i, len);
+    }
+}
+
+// Euclidean norm, accumulated in fp32. Eight partial sums let the compiler keep the loop in
+// vector registers without reassociating floating-point additions itself.
+template <class T> float norm(const T* x, std::size_t n) {
+    float fx[block];
+    float partial[8] = {};
+    for (std::size_t i = 0; i < n; i += block) {
+        const std::size_t len = n - i < block ? n - i : block;
+        to_float(x + i, fx, len);
+        std::size_t j = 0;
+        for (; j + 8 <= len; j += 8) {
+            for (std::size_t k = 0; k < 8; ++k) {
+                partial[k] += fx[j + k] * fx[j + k];
+            }
+        }
+        for (; j < len; ++j) {
+            partial[0] += fx[j] * fx[j];
+        }
+    }
+    float sum = 0.f;
+    for (float p : partial) {
+        sum += p;
+    }
+    return std::sqrt(sum);
+}
+} // namespace lowp
+
+#endif // REDUCEDPRECISION_H_
@@ -0,0 +1,75 @@
+// -*-c++-*-
+#ifndef WAVEPLAN_H
+#define WAVEPLAN_H
+// Static list schedule for running batches of same-shaped events in lockstep waves. Nodes are
+// grouped into levels (a node's level is one more than its deepest input), and the work of each
+// level, a node for a range of events per slot, is dealt to the workers ahead of time. Running a
+// batch then needs no dependency tracking at all, only a barrier between levels.
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "NodeOpts.h"
+
+namespace sch {
+struct WaveSlot {
+    std::size_t node;
+    std::size_t first_event;
+    std::size_t last_event; // one past the end
+};
+
+struct WavePlan {
+    std::size_t n_workers = 0;
+    std::size_t n_events = 0;
+    // levels[level][worker]: what the worker runs in that level, in order
+    std::vector<std::vector<std::vector<WaveSlot>>> levels{};
+};
+
+// Longest processing time first: within a level, the slots (each needed node cut into one event
+// range per worker) go, most expensive first, to the worker with the least work so far
+template <std::size_t N>
+WavePlan make_wave_plan(const GraphShape<N>& shape, std::size_t n_workers, std::size_t n_events) {
+    WavePlan plan{n_workers, n_events, {}};
+    auto needed = needed_nodes(shape);
+    std::array<std::size_t, N> level{};
+    std::size_t n_levels = 0;
+    for (std::size_t pass = 0; pass < N; ++pass) {
+        for (std::size_t k = 0; k < N; ++k) {
+            for (auto in : shape.inputs[k]) {
+                level[k] = std::max(level[k], level[in] + 1);
+            }
+        }
+    }
+    for (std::size_t k = 0; k < N; ++k) {
+        if (needed[k]) {
+            n_levels = std::max(n_levels, level[k] + 1);
+        }
+    }
+    const std::size_t n_chunks = std::max<std::size_t>(1, std::min(n_workers, n_events));
+    plan.levels.assign(n_levels, std::vector<std::vector<WaveSlot>>(n_workers));
+    for (std::size_t l = 0; l < n_levels; ++l) {
+        std::vector<std::pair<double, WaveSlot>> slots{};
+        for (std::size_t k = 0; k < N; ++k) {
+            if (!needed[k] || level[k] != l) {
+                continue;
+            }
+            for (std::size_t c = 0; c < n_chunks; ++c) {
+                WaveSlot slot{k, n_events * c / n_chunks, n_events * (c + 1) / n_chunks};
+                slots.emplace_back(shape.costs[k] * (slot.last_event - slot.first_event), slot);
+            }
+        }
+        std::stable_sort(slots.begin(), slots.end(),
+                         [](const auto& a, const auto& b) { return a.first > b.first; });
+        std::vector<double> load(n_workers, 0);
+        for (const auto& [cost, slot] : slots) {
+            auto w = std::min_element(load.begin(), load.end()) - load.begin();
+            load[w] += cost;
+            plan.levels[l][w].push_back(slot);
+        }
+    }
+    return plan;
+}
+} // namespace sch
+
+#endif /* WAVEPLAN_H */
@@ -0,0 +1,26 @@
+// Converts the text event format (as in test/test.txt) to the columnar format read by the mains
+#include <fstream>
+
+#include "EvtColumns.h"
+#include <fmt/format.h>
+
+// Must match the inputs of the event contexts that will read the file
+struct EvtRow {
+    BOOST_HANA_DEFINE_STRUCT(EvtRow, (long long, X), (long long, Y));
+};
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fmt::print("Usage: {} input.txt output.evtc\n", argv[0]);
+        return 1;
+    }
+    std::ifstream in{argv[1]};
+    if (!in) {
+        fmt::print("Cannot open {}\n", argv[1]);
+        return 1;
+    }
+    auto rows = sch::io::read_text_rows<EvtRow>(in);
+    sch::io::write_columns(argv[2], rows);
+    fmt::print("Wrote {} events to {}\n", rows.size(), argv[2]);
+    return 0;
+}
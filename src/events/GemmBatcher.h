@@ -0,0 +1,128 @@
+// -*-c++-*-
+#ifndef GEMMBATCHER_H
+#define GEMMBATCHER_H
+// Coalesces the matrix products of different events into cblas_sgemm_batch calls
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <mkl_cblas.h>
+
+#include <hpx/local/future.hpp>
+#include <hpx/async_base/async.hpp>
+#include <hpx/synchronization/spinlock.hpp>
+
+#include "CPUMtrx.h"
+
+// Products are queued until batch_size of them are pending, or until window has passed since
+// the first one, and then run as a single batch. The submitter that fills a batch runs it;
+// otherwise a timer task started with the first product does. Every product in a batch has the
+// same shape, and inputs shared by several products (e.g. a common B) are passed to MKL as the
+// same pointer rather than copied. The batcher must outlive the products submitted to it.
+template <int Rows> class GemmBatcher {
+  public:
+    using Mtrx = CPUMtrx<Rows>;
+
+  private:
+    struct Pending {
+        std::vector<const float*> a{};
+        std::vector<const float*> b{};
+        std::vector<hpx::promise<Mtrx>> promises{};
+    };
+    std::size_t batch_size;
+    std::chrono::steady_clock::duration window;
+    Pending pending{};
+    std::size_t generation = 0; // Number of batches taken so far
+    hpx::spinlock mtx{};
+
+    Pending take_locked() {
+        ++generation;
+        Pending batch = std::move(pending);
+        pending = Pending{};
+        pending.a.reserve(batch_size);
+        pending.b.reserve(batch_size);
+        pending.promises.reserve(batch_size);
+        return batch;
+    }
+
+    static void run(Pending& batch) {
+        const MKL_INT n = Rows;
+        const MKL_INT group_size = batch.promises.size();
+        const CBLAS_TRANSPOSE no_trans = CBLAS_TRANSPOSE::CblasNoTrans;
+        const float alpha = 1;
+        const float beta = 0;
+        try {
+            std::vector<Mtrx> results(group_size);
+            std::vector<float*> c{};
+            c.reserve(group_size);
+            for (auto& result : results) {
+                c.push_back(result.data());
+            }
+            cblas_sgemm_batch(CBLAS_LAYOUT::CblasColMajor, &no_trans, &no_trans, &n, &n, &n,
+                              &alpha, batch.a.data(), &n, batch.b.data(), &n, &beta, c.data(), &n,
+                              1, &group_size);
+            for (MKL_INT i = 0; i < group_size; ++i) {
+                batch.promises[i].set_value(std::move(results[i]));
+            }
+        }
+        catch (...) {
+            for (auto& promise : batch.promises) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    }
+
+    // Runs the batch that was pending when the timer was started, unless it already ran
+    void flush(std::size_t batch_generation) {
+        std::unique_lock lock{mtx};
+        if (generation != batch_generation || pending.promises.empty()) {
+            return;
+        }
+        Pending batch = take_locked();
+        lock.unlock();
+        run(batch);
+    }
+
+  public:
+    GemmBatcher(std::size_t batch_size, std::chrono::steady_clock::duration window)
+          : batch_size(batch_size), window(window) {
+        pending.a.reserve(batch_size);
+        pending.b.reserve(batch_size);
+        pending.promises.reserve(batch_size);
+    }
+    GemmBatcher(const GemmBatcher&) = delete;
+    GemmBatcher& operator=(const GemmBatcher&) = delete;
+
+    // Takes effect from the next product; a smaller size runs the pending batch with it
+    void set_batch_size(std::size_t n) {
+        std::lock_guard lock{mtx};
+        batch_size = std::max<std::size_t>(n, 1);
+    }
+
+    // Future to x * y. x and y must stay alive until it is ready.
+    hpx::future<Mtrx> multiply(const Mtrx& x, const Mtrx& y) {
+        std::unique_lock lock{mtx};
+        pending.a.push_back(x.data());
+        pending.b.push_back(y.data());
+        auto fut = pending.promises.emplace_back().get_future();
+        if (pending.promises.size() >= batch_size) {
+            Pending batch = take_locked();
+            lock.unlock();
+            run(batch);
+        }
+        else if (pending.promises.size() == 1) {
+            // Sleeping suspends the timer task, not the worker running it
+            hpx::async([this, batch_generation = generation] {
+                hpx::this_thread::sleep_for(window);
+                flush(batch_generation);
+            });
+        }
+        return fut;
+    }
+};
+
+#endif /* GEMMBATCHER_H */
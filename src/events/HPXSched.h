@@ -1,8 +1,18 @@
 // -*-c++-*-
 #ifndef HPXSCHED_H
 #define HPXSCHED_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -17,56 +27,439 @@ namespace ct = boost::callable_traits;
 namespace hana = boost::hana;
 using namespace hana::literals;
 
+#include <hpx/algorithm.hpp>
 #include <hpx/async_base/async.hpp>
 #include <hpx/async_base/dataflow.hpp>
+#include <hpx/async_combinators/wait_all.hpp>
+#include <hpx/async_combinators/split_future.hpp>
+#include <hpx/barrier.hpp>
+#include <hpx/execution.hpp>
 #include <hpx/local/future.hpp>
+#include <hpx/numeric.hpp>
 #include <hpx/pack_traversal/unwrap.hpp>
+#include <hpx/runtime.hpp>
+
+#include "Filter.h"
+#include "LatencyHistogram.h"
+#include "NodeOpts.h"
+#include "MemStats.h"
+#include "OldestFirst.h"
+#include "Outputs.h"
+#include "PerfCounters.h"
+#include "WavePlan.h"
 
 namespace sch {
+namespace ex = hpx::execution::experimental;
+
 class input_tag {};
 template <class HS> struct Input {
     using hana_tag = sch::input_tag;
     HS name;
 
+    constexpr Input() = default;
     constexpr Input(HS name) : name(name) {}
 };
-template <class Key, class Inputs, class Func> auto Define(Key key, Inputs inputs, Func func) {
+// A function returning a future (an async service call, or a coroutine returning hpx::future)
+// makes an asynchronous node: its value is the one the returned future ends up holding
+template <class T> struct node_value { using type = T; };
+template <class T> struct node_value<hpx::future<T>> { using type = T; };
+template <class T> struct node_value<hpx::shared_future<T>> { using type = T; };
+template <class T> using node_value_t = typename node_value<T>::type;
+
+template <class Key, class Inputs, class Func, class... Opts>
+auto Define(Key key, Inputs inputs, Func func, Opts... opts) {
     static_assert(hana::is_a<hana::string_tag>(key), "Define's key must be a hana::string");
     static_assert(hana::Sequence<Inputs>::value, "Define's inputs must be a tuple");
-    using func_ret_t = ct::return_type_t<Func>;
+    using func_ret_t = node_value_t<ct::return_type_t<Func>>;
     using fut_p = hpx::shared_future<func_ret_t>*;
     // Tuple items are: key, inputs tuple, function to calculate, required, func returning
-    // ref-to-ptr-to-future, prototype ptr-to-future
-    return hana::make_pair(key, hana::make_tuple(
-                                      key, inputs, std::function{func}, false,
-                                      [](auto& ec) -> fut_p& { return ec.slot[Key{}]; }, fut_p{}));
+    // ref-to-ptr-to-future, prototype ptr-to-future of the function's value, node options. The
+    // slot's future holds a std::optional of that value instead if the node is gated (see
+    // Filter.h).
+    return hana::make_pair(
+          key, hana::make_tuple(key, inputs, std::function{func}, false,
+                                [](auto& ec) -> auto& { return ec.slot[Key{}]; }, fut_p{},
+                                make_node_opts(opts...)));
+}
+
+// Nodes over a collection. The function of a map node takes one element of its first input, a
+// std::vector, and the other inputs whole; the node's value is the vector of the results. A
+// reduce node combines the results instead, starting from init, which must be an identity of
+// combine. Collections of up to a chunk (see chunk_size) are done in the node's task, longer
+// ones in chunks by hpx::for_each or hpx::transform_reduce with the par policy.
+template <class Func, class Args = ct::args_t<Func>> struct MapFn;
+template <class Func, class T, class... Args> struct MapFn<Func, std::tuple<T, Args...>> {
+    using Elem = std::decay_t<T>;
+    using U = ct::return_type_t<Func>;
+    static_assert(!std::is_same_v<U, bool>, "std::vector<bool> cannot be written in parallel");
+    Func func;
+    std::size_t grain;
+
+    std::vector<U> operator()(const std::vector<Elem>& xs, Args... args) const {
+        std::vector<U> result(xs.size());
+        auto one = [&](const Elem& x) { result[&x - xs.data()] = func(x, args...); };
+        const std::size_t chunk = chunk_size(xs.size(), grain, hpx::get_os_thread_count());
+        if (xs.size() <= chunk) {
+            std::for_each(xs.begin(), xs.end(), one);
+        }
+        else {
+            namespace hx = hpx::execution;
+            hpx::for_each(hx::par.with(hx::experimental::static_chunk_size(chunk)), xs.begin(),
+                          xs.end(), one);
+        }
+        return result;
+    }
+};
+template <class Func, class Combine, class R, class Args = ct::args_t<Func>> struct ReduceFn;
+template <class Func, class Combine, class R, class T, class... Args>
+struct ReduceFn<Func, Combine, R, std::tuple<T, Args...>> {
+    using Elem = std::decay_t<T>;
+    Func func;
+    Combine combine;
+    R init;
+    std::size_t grain;
+
+    R operator()(const std::vector<Elem>& xs, Args... args) const {
+        auto one = [&](const Elem& x) { return func(x, args...); };
+        const std::size_t chunk = chunk_size(xs.size(), grain, hpx::get_os_thread_count());
+        if (xs.size() <= chunk) {
+            return std::transform_reduce(xs.begin(), xs.end(), init, combine, one);
+        }
+        namespace hx = hpx::execution;
+        return hpx::transform_reduce(hx::par.with(hx::experimental::static_chunk_size(chunk)),
+                                     xs.begin(), xs.end(), init, combine, one);
+    }
+};
+
+template <class Key, class Inputs, class Func, class... Opts>
+auto DefineMap(Key key, Inputs inputs, Func func, Opts... opts) {
+    return Define(key, inputs, MapFn<Func>{func, make_node_opts(opts...).grain}, opts...);
+}
+
+template <class Key, class Inputs, class Func, class Combine, class R, class... Opts>
+auto DefineReduce(Key key, Inputs inputs, Func func, Combine combine, R init, Opts... opts) {
+    return Define(key, inputs,
+                  ReduceFn<Func, Combine, R>{func, combine, init, make_node_opts(opts...).grain},
+                  opts...);
+}
+
+// Which nodes are gated by a filter, worked out from the map of definitions. The slot types
+// depend on it, so it is needed before Sched is complete.
+template <class Map, class Key> using def_t = std::decay_t<decltype(std::declval<Map&>()[Key{}])>;
+template <class Map, class Key>
+using fn_value_t = typename hpx::traits::future_traits<std::remove_pointer_t<
+      std::decay_t<decltype(hana::at_c<5>(std::declval<def_t<Map, Key>&>()))>>>::type;
+template <class Map, class Key> constexpr bool gated();
+template <class Map, class Key> constexpr bool may_be_empty() {
+    if constexpr (hana::is_a<sch::input_tag, Key>()) {
+        return false;
+    }
+    else {
+        return is_optional_v<fn_value_t<Map, Key>> || gated<Map, Key>();
+    }
+}
+template <class Map, class Key> constexpr bool gated() {
+    using inputs_t = std::decay_t<decltype(hana::at_c<1>(std::declval<def_t<Map, Key>&>()))>;
+    return hana::unpack(inputs_t{}, [](auto... in) {
+        return (may_be_empty<Map, source_t<decltype(in)>>() || ...);
+    });
 }
+// Value in the slot of node Key
+template <class Map, class Key>
+using slot_value_t = std::conditional_t<gated<Map, Key>(), maybe_t<fn_value_t<Map, Key>>,
+                                        fn_value_t<Map, Key>>;
 
 template <class... Defs> class Sched {
   private:
     hana::map<Defs...> definitions;
     using Keys = decltype(hana::keys(definitions));
-    using FutTypes = decltype(hana::transform(hana::values(definitions),
-                                              hana::reverse_partial(hana::at, hana::size_c<5>)));
+    static constexpr auto make_fut_p = [](auto key) {
+        using T = slot_value_t<hana::map<Defs...>, decltype(key)>;
+        return static_cast<hpx::shared_future<T>*>(nullptr);
+    };
+    using FutTypes = decltype(hana::transform(Keys{}, make_fut_p));
+    static constexpr std::size_t n_nodes = hana::length(Keys{});
+    // For the wave engine, which keeps plain values instead of futures
+    static constexpr auto make_value = [](auto fut_p) {
+        using T = std::remove_pointer_t<decltype(fut_p)>;
+        return std::optional<typename hpx::traits::future_traits<T>::type>{};
+    };
+    using ValueTypes = decltype(hana::transform(FutTypes{}, make_value));
+
+    // Nodes on the critical path run with high priority, the rest with the default one.
+    // Recomputed on the next schedule() after the required nodes or the costs change.
+    std::array<hpx::threads::thread_priority, n_nodes> priorities{};
+    bool priorities_stale = true;
+    // Executors of the nodes with a pool option, when that pool exists; built with the
+    // priorities
+    std::array<std::optional<hpx::execution::parallel_executor>, n_nodes> executors{};
+    // Static schedule of the wave engine, rebuilt when its inputs change
+    WavePlan wave_plan{};
+    bool wave_plan_stale = true;
+    // Hardware counters per node, when enabled
+    std::unique_ptr<perf::NodeCounters<n_nodes>> perf_counters{};
+    // Memory of the intermediates the scheduler frees (pointer values of nodes that are not
+    // retrieved) and events between schedule and the end of their cleanup
+    MemStats<n_nodes> mem_stats{};
+    // When set, the futures engine runs the ready nodes of the oldest event first
+    std::unique_ptr<OldestFirst> oldest_first{};
+    std::uint64_t next_seq = 0;
+    // Time from submitting an event until all its retrieved outputs are ready
+    LatencyHistogram latencies{};
+
+    template <class Key> static constexpr std::size_t index_of() {
+        using index_t = decltype(hana::index_if(Keys{}, hana::equal.to(Key{})).value());
+        return std::decay_t<index_t>::value;
+    }
+
+    GraphShape<n_nodes> shape() {
+        GraphShape<n_nodes> result{};
+        hana::for_each(Keys{}, [&](auto key) {
+            constexpr std::size_t k = index_of<decltype(key)>();
+            auto& item = definitions[key];
+            result.required[k] = hana::at_c<3>(item);
+            result.costs[k] = hana::at_c<6>(item).cost;
+            hana::for_each(hana::at_c<1>(item), [&](auto in) {
+                if constexpr (!hana::is_a<sch::input_tag>(in)) {
+                    result.inputs[k].push_back(index_of<source_t<decltype(in)>>());
+                }
+            });
+        });
+        return result;
+    }
+
+    void update_priorities() {
+        auto critical = critical_nodes(shape());
+        for (std::size_t k = 0; k < n_nodes; ++k) {
+            priorities[k] = critical[k] ? hpx::threads::thread_priority::high
+                                        : hpx::threads::thread_priority::default_;
+        }
+        hana::for_each(Keys{}, [this](auto key) {
+            constexpr std::size_t k = index_of<decltype(key)>();
+            const char* pool = hana::at_c<6>(definitions[key]).pool;
+            executors[k].reset();
+            if (pool && hpx::resource::pool_exists(pool)) {
+                executors[k].emplace(&hpx::resource::get_thread_pool(pool), priorities[k]);
+            }
+        });
+        priorities_stale = false;
+    }
+
+    // Future to call(), queued behind the tasks of older events in the lane of Key: its pool
+    // (with executor, as update_priorities() set it up) and priority
+    template <class Key, class Call>
+    auto submit_oldest(std::uint64_t seq, hpx::threads::thread_priority priority,
+                       const std::optional<hpx::execution::parallel_executor>& executor,
+                       Call call) {
+        const char* pool = hana::at_c<6>(definitions[Key{}]).pool;
+        OldestFirst::Lane lane{executor ? pool : "", priority};
+        if (executor) {
+            return oldest_first->submit(seq, std::move(lane), *executor, std::move(call));
+        }
+        return oldest_first->submit(seq, std::move(lane), hpx::launch::async_policy{priority},
+                                    std::move(call));
+    }
+
+    // func, with its hardware counters charged to Key when they are enabled, and the memory of
+    // its value counted if the scheduler is going to free it
+    template <class Key, class Func> auto instrumented(Func func) {
+        const bool intermediate = !hana::at_c<3>(definitions[Key{}]);
+        return [this, func, intermediate](auto&&... args) {
+            auto result = [&] {
+                if (!perf_counters) {
+                    return func(args...);
+                }
+                return perf_counters->measure(index_of<Key>(), [&] { return func(args...); });
+            }();
+            if constexpr (owns_memory_v<decltype(result)>) {
+                if (intermediate) {
+                    mem_stats.produced(index_of<Key>(), bytes_of(owned_ptr(result)));
+                }
+            }
+            return result;
+        };
+    }
+
+    // Records the latency of ec once the last of its required outputs is ready
+    template <class EC> void time_outputs(EC& ec, std::chrono::steady_clock::time_point start) {
+        std::size_t n_outputs = 0;
+        hana::for_each(Keys{}, [&](auto key) { n_outputs += hana::at_c<3>(definitions[key]); });
+        auto remaining = std::make_shared<std::atomic<std::size_t>>(n_outputs);
+        hana::for_each(Keys{}, [&](auto key) {
+            auto& item = definitions[key];
+            if (hana::at_c<3>(item)) {
+                hana::at_c<4>(item)(ec)->then([this, start, remaining](auto&&) {
+                    if (remaining->fetch_sub(1) == 1) {
+                        latencies.record(std::chrono::steady_clock::now() - start);
+                    }
+                });
+            }
+        });
+    }
+
+    // Future of a node's value from the future returned by async/dataflow. For asynchronous
+    // nodes that is a future of the returned future, unwrapped here without waiting: the
+    // worker that ran the function is free as soon as it returns.
+    template <class Fut, class Ret = typename hpx::traits::future_traits<std::decay_t<Fut>>::type>
+    static auto* make_slot(Fut&& fut) {
+        using T = node_value_t<Ret>;
+        return new hpx::shared_future<T>{hpx::future<T>{std::forward<Fut>(fut)}};
+    }
+
+    template <class Key> using slot_value = slot_value_t<hana::map<Defs...>, Key>;
+    template <class Key> static constexpr bool is_gated() {
+        return gated<hana::map<Defs...>, Key>();
+    }
+
+    // func, returning the slot value of Key; if Key is gated, taking the values of its inputs
+    // as they are in their slots and skipping the call when one of them is empty
+    template <class Key, class Func> static auto skip_empty(Func func) {
+        if constexpr (is_gated<Key>()) {
+            return [func](const auto&... in) -> slot_value<Key> {
+                if (!(present(in) && ...)) {
+                    return {};
+                }
+                return func(unwrap(in)...);
+            };
+        }
+        else {
+            return func;
+        }
+    }
+
+    // Body of a gated node for the futures engine. It runs inline in the thread that readies
+    // the last input, so a rejected event completes the node without a task; otherwise it
+    // starts the node as schedule() would.
+    template <class Key, class Func> auto gate(Func func, std::uint64_t seq) {
+        const auto priority = priorities[index_of<Key>()];
+        const auto executor = executors[index_of<Key>()];
+        return [this, func, seq, priority, executor](auto... in) {
+            using R = slot_value<Key>;
+            if (!(present(in.get()) && ...)) {
+                return hpx::make_ready_future(R{});
+            }
+            auto call = [func, in...] { return func(unwrap(in.get())...); };
+            auto start = [&]() -> hpx::future<value_of<Key>> {
+                // Asynchronous nodes only start a call, so they never wait their turn
+                if constexpr (std::is_same_v<value_of<Key>, decltype(call())>) {
+                    if (oldest_first) {
+                        return submit_oldest<Key>(seq, priority, executor, call);
+                    }
+                }
+                if (executor) {
+                    return hpx::future<value_of<Key>>{hpx::async(*executor, call)};
+                }
+                return hpx::future<value_of<Key>>{
+                      hpx::async(hpx::launch::async_policy{priority}, call)};
+            };
+            auto fut = start();
+            if constexpr (std::is_same_v<value_of<Key>, R>) {
+                return fut;
+            }
+            else {
+                return fut.then(hpx::launch::sync, [](auto&& done) { return R{done.get()}; });
+            }
+        };
+    }
 
   public:
     struct ECBase {
         decltype(hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{})))
               slot = hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{}));
+        decltype(hana::to_map(hana::zip_with(hana::make_pair, Keys{}, ValueTypes{}))) wave_value{};
+        std::uint64_t seq = 0; // Order in which schedule() was called for the event
+
+        // Frees the futures of the last event so the context can be reused. Only call this once
+        // the event (and its cleanup) has finished.
+        void reset() {
+            hana::for_each(Keys{}, [this](auto key) {
+                auto& fut = slot[key];
+                delete fut;
+                fut = nullptr;
+                wave_value[key].reset();
+            });
+        }
     };
 
     Sched(Defs... defs) : definitions(hana::make_map(defs...)) {}
     template <typename Key> auto& retrieve(ECBase& ec, Key key) {
         static_assert(!hana::is_a<sch::input_tag>(key), "Cannot 'retrieve' an input");
-        hana::at_c<3>(definitions[key]) = true;     // Record that we need to calculate this value
+        auto& required = hana::at_c<3>(definitions[key]);
+        if (!required) {
+            required = true; // Record that we need to calculate this value
+            priorities_stale = true;
+            wave_plan_stale = true;
+        }
         return hana::at_c<4>(definitions[key])(ec); // Return reference to pointer to future
     }
 
+    // Measures cycles, instructions, LLC and dTLB misses of every node run from now on (see
+    // PerfCounters.h). Call before scheduling anything.
+    void enable_perf_counters() { perf_counters = std::make_unique<perf::NodeCounters<n_nodes>>(); }
+
+    // Makes schedule() run the ready nodes of the event scheduled first before those of later
+    // events (see OldestFirst.h), instead of leaving the order to HPX's queues. Old events then
+    // finish, and free their intermediates, before new ones get going. Nodes keep their pool
+    // and priority: the order applies among the nodes sharing both. Costs a locked heap push and
+    // pop per node. Call before scheduling anything.
+    void prioritize_oldest_events() { oldest_first = std::make_unique<OldestFirst>(); }
+
+    // Names of the thread pools the nodes ask for, each once, for setting them up with the
+    // resource partitioner before the runtime starts. Nodes whose pool was not set up run on
+    // the default pool.
+    std::vector<std::string> pool_names() const {
+        std::vector<std::string> names{};
+        hana::for_each(hana::values(definitions), [&names](auto&& item) {
+            const char* pool = hana::at_c<6>(item).pool;
+            if (pool && std::find(names.begin(), names.end(), pool) == names.end()) {
+                names.emplace_back(pool);
+            }
+        });
+        return names;
+    }
+
+    const MemStats<n_nodes>& memory() const { return mem_stats; }
+
+    void print_memory() const {
+        std::array<const char*, n_nodes> names{};
+        hana::for_each(Keys{},
+                       [&names](auto key) { names[index_of<decltype(key)>()] = key.c_str(); });
+        mem_stats.print(names);
+    }
+
+    const LatencyHistogram& latency() const { return latencies; }
+
+    void print_latency() const { latencies.print("Event latency"); }
+
+    void print_perf_counters() const {
+        if (!perf_counters) {
+            return;
+        }
+        std::array<const char*, n_nodes> names{};
+        hana::for_each(Keys{},
+                       [&names](auto key) { names[index_of<decltype(key)>()] = key.c_str(); });
+        perf_counters->print(names);
+    }
+
+    // Replaces the cost of a node, e.g. with a measured run time, so the critical path follows
+    // what the nodes actually cost
+    template <typename Key> void set_cost(Key key, double cost) {
+        hana::at_c<6>(definitions[key]).cost = cost;
+        priorities_stale = true;
+        wave_plan_stale = true;
+    }
+
     // This function does the scheduling (and running)
     // For now, lets use HPX
     template <typename EC> bool schedule(EC& ec) {
         constexpr auto dataflow = BOOST_HOF_LIFT(hpx::dataflow);
         constexpr auto is_required = hana::reverse_partial(hana::at, hana::size_c<3>);
+        if (priorities_stale) {
+            update_priorities();
+        }
+        const auto start = std::chrono::steady_clock::now();
+        ec.seq = next_seq++;
+        mem_stats.events_started();
         // Given a key, schedule the computation for that value
         auto run = hana::fix([this, &dataflow, &ec](auto self, auto key) {
             if constexpr (hana::is_a<sch::input_tag>(key)) {
@@ -82,18 +475,52 @@ template <class... Defs> class Sched {
                     return *res;
                 }
                 auto inputs = hana::at_c<1>(item);
+                // Nodes (or event inputs) to wait for; outputs are picked out by func
+                auto sources =
+                      hana::transform(inputs, [](auto in) { return source_t<decltype(in)>{}; });
                 // Schedule this function
-                auto func = hana::at_c<2>(item);
-                if constexpr (hana::is_empty(inputs)) {
-                    // fmt::print("Scheduling {} with no inputs\n", key.c_str());
-                    res = new hpx::shared_future{hpx::async(func)};
+                auto func = instrumented<decltype(key)>(pick_inputs(inputs, hana::at_c<2>(item)));
+                const auto priority = priorities[index_of<decltype(key)>()];
+                hpx::launch::async_policy policy{priority};
+                const auto& executor = executors[index_of<decltype(key)>()];
+                auto launch_on = [&](auto how, auto f) {
+                    if constexpr (hana::is_empty(inputs)) {
+                        // fmt::print("Scheduling {} with no inputs\n", key.c_str());
+                        return make_slot(hpx::async(how, f));
+                    }
+                    else {
+                        // Schedule every input
+                        auto input_res = hana::transform(sources, self);
+                        // fmt::print("Scheduling calculation of {} with inputs\n", key.c_str());
+                        return make_slot(hana::unpack(
+                              input_res, hana::partial(dataflow, how, hpx::unwrapping(f))));
+                    }
+                };
+                // On the node's own pool if it has one
+                auto launch = [&](auto f) {
+                    return executor ? launch_on(*executor, f) : launch_on(policy, f);
+                };
+                if constexpr (is_gated<decltype(key)>()) {
+                    // Skipped when an input is empty, see gate()
+                    auto input_res = hana::transform(sources, self);
+                    res = make_slot(hana::unpack(
+                          input_res, hana::partial(dataflow, hpx::launch::sync,
+                                                   gate<decltype(key)>(func, ec.seq))));
+                }
+                // Asynchronous nodes only start a call, so they never wait their turn
+                else if constexpr (std::is_same_v<value_of<decltype(key)>,
+                                                  ct::return_type_t<decltype(hana::at_c<2>(
+                                                        item))>>) {
+                    // Once its inputs are ready, the node queues behind the nodes of older events
+                    // of its lane. Queueing is done inline; the task runs where submit starts it.
+                    auto ordered = [this, seq = ec.seq, priority, executor, func](auto... args) {
+                        auto call = [func, args...] { return func(args...); };
+                        return submit_oldest<decltype(key)>(seq, priority, executor, call);
+                    };
+                    res = oldest_first ? launch_on(hpx::launch::sync, ordered) : launch(func);
                 }
                 else {
-                    // Schedule every input
-                    auto input_res = hana::transform(inputs, self);
-                    // fmt::print("Scheduling calculation of {} with inputs\n", key.c_str());
-                    res = new hpx::shared_future{
-                          hana::unpack(input_res, hana::partial(dataflow, hpx::unwrapping(func)))};
+                    res = launch(func);
                 }
                 // Return future to be used as input in downstream calculations
                 return *res;
@@ -108,6 +535,242 @@ template <class... Defs> class Sched {
             run(key);
         };
         hana::for_each(hana::keys(definitions), run_if_required);
+        time_outputs(ec, start);
+        return true;
+    }
+
+  private:
+    // Compile-time structure of the graph, for the senders engine
+    template <class Key, int I>
+    using item_t =
+          std::decay_t<decltype(hana::at_c<I>(std::declval<hana::map<Defs...>&>()[Key{}]))>;
+    template <class Key> using inputs_of = item_t<Key, 1>;
+    template <class Key>
+    using value_of =
+          typename hpx::traits::future_traits<std::remove_pointer_t<item_t<Key, 5>>>::type;
+
+    // Longest chain of nodes from the event inputs to Key
+    template <class Key> static constexpr std::size_t depth() {
+        if constexpr (hana::is_a<sch::input_tag, Key>()) {
+            return 0;
+        }
+        else {
+            return hana::unpack(inputs_of<Key>{}, [](auto... in) {
+                return std::max({std::size_t{0}, depth<source_t<decltype(in)>>()...}) + 1;
+            });
+        }
+    }
+    // Whether Key is Node or one of its (transitive) inputs
+    template <class Key, class Node> static constexpr bool feeds() {
+        if constexpr (hana::is_a<sch::input_tag, Node>()) {
+            return false;
+        }
+        else if constexpr (std::is_same_v<Key, Node>) {
+            return true;
+        }
+        else {
+            return hana::unpack(inputs_of<Node>{}, [](auto... in) {
+                return (feeds<Key, source_t<decltype(in)>>() || ...);
+            });
+        }
+    }
+    // Number of inputs of Node reading (an output of) Key
+    template <class Node, class Key> static constexpr std::size_t reads() {
+        return hana::unpack(inputs_of<Node>{}, [](auto... in) {
+            return (std::is_same_v<source_t<decltype(in)>, Key> + ... + 0);
+        });
+    }
+    template <class Key, class... Outs> static constexpr bool needed() {
+        return (feeds<Key, Outs>() || ...);
+    }
+    // Values handed to slots: the outputs, and intermediates owning memory so cleanup() can
+    // free them as it does for the futures engine
+    template <class Key, class... Outs> static constexpr bool exported() {
+        return (std::is_same_v<Key, Outs> || ...)
+               || (needed<Key, Outs...>() && owns_memory_v<slot_value<Key>>);
+    }
+    // Number of times the value of node Key is used, by needed nodes or by a slot
+    template <class Key, class... Outs> static constexpr std::size_t uses() {
+        if constexpr (hana::is_a<sch::input_tag, Key>()) {
+            return 0;
+        }
+        else {
+            return hana::unpack(Keys{}, [](auto... k) {
+                       return ((needed<decltype(k), Outs...>() * reads<decltype(k), Key>()) + ...
+                               + 0);
+                   })
+                   + exported<Key, Outs...>();
+        }
+    }
+
+  public:
+    // Alternative engine: the event's graph, restricted to what the outputs need, is composed
+    // as one sender (when_all/then, with split only where a value has several users) and
+    // submitted once. The futures engine above pays for a shared state and a continuation per
+    // edge; here the operation state of the whole event lives in a single allocation. The
+    // graph is fixed at compile time, so the outputs are passed here rather than taken from
+    // retrieve(), which must still be called to get their slots. Asynchronous nodes and the
+    // critical-path priorities are only supported by schedule().
+    template <class EC, class... Outs> bool schedule_senders(EC& ec, Outs...) {
+        static_assert((!hana::is_a<sch::input_tag, Outs>() && ...), "Cannot 'retrieve' an input");
+        const auto start = std::chrono::steady_clock::now();
+        mem_stats.events_started();
+        ex::thread_pool_scheduler sched{};
+        // Needed nodes, every one after its inputs
+        auto order = hana::sort(
+              hana::filter(Keys{},
+                           [](auto k) { return hana::bool_c<needed<decltype(k), Outs...>()>; }),
+              [](auto a, auto b) {
+                  return hana::bool_c<(depth<decltype(a)>() < depth<decltype(b)>())>;
+              });
+        auto senders = hana::fold_left(order, hana::make_map(), [this, &ec, &sched](auto built,
+                                                                                     auto key) {
+            using Key = decltype(key);
+            auto& item = this->definitions[key];
+            static_assert(std::is_same_v<value_of<Key>, ct::return_type_t<decltype(hana::at_c<2>(
+                                                               item))>>,
+                          "Asynchronous nodes need schedule()");
+            auto input_sender = [&ec, &built](auto in) {
+                if constexpr (hana::is_a<sch::input_tag>(in)) {
+                    return ex::just(hana::at_key(ec, in.name));
+                }
+                else {
+                    return built[source_t<decltype(in)>{}];
+                }
+            };
+            // Branches after a split continue on their own task, so they run in parallel;
+            // otherwise a node runs straight after its input on the same worker
+            constexpr bool after_split = hana::unpack(inputs_of<Key>{}, [](auto... in) {
+                return ((uses<source_t<decltype(in)>, Outs...>() > 1) || ...);
+            });
+            auto func = skip_empty<Key>(this->template instrumented<Key>(
+                  pick_inputs(hana::at_c<1>(item), hana::at_c<2>(item))));
+            auto node = [&] {
+                auto inputs = hana::unpack(hana::transform(hana::at_c<1>(item), input_sender),
+                                           ex::when_all);
+                if constexpr (hana::is_empty(inputs_of<Key>{})) {
+                    return ex::schedule(sched) | ex::then(func);
+                }
+                else if constexpr (after_split) {
+                    return std::move(inputs) | ex::transfer(sched) | ex::then(func);
+                }
+                else {
+                    return std::move(inputs) | ex::then(func);
+                }
+            }();
+            if constexpr (uses<Key, Outs...>() > 1) {
+                return hana::insert(built, hana::make_pair(key, ex::split(std::move(node))));
+            }
+            else {
+                return hana::insert(built, hana::make_pair(key, std::move(node)));
+            }
+        });
+        auto exports = hana::filter(
+              order, [](auto k) { return hana::bool_c<exported<decltype(k), Outs...>()>; });
+        auto all = hana::unpack(hana::transform(exports, [&senders](auto k) { return senders[k]; }),
+                                ex::when_all)
+                   | ex::then([this, start](auto&&... vals) {
+                         latencies.record(std::chrono::steady_clock::now() - start);
+                         return hpx::make_tuple(vals...);
+                     });
+        auto parts = hpx::split_future(ex::make_future(std::move(all)));
+        hana::for_each(hana::make_range(hana::size_c<0>, hana::length(exports)), [&](auto i) {
+            auto key = hana::at(exports, i);
+            hana::at_c<4>(definitions[key])(ec) = new hpx::shared_future<slot_value<decltype(key)>>{
+                  std::move(hpx::get<decltype(i)::value>(parts))};
+        });
+        return true;
+    }
+
+  private:
+    // Runs one node of one event in the calling thread, for the wave engine
+    template <class EC, class Key> void run_now(EC& ec, Key key) {
+        auto& item = definitions[key];
+        static_assert(std::is_same_v<value_of<Key>, ct::return_type_t<decltype(hana::at_c<2>(
+                                                           item))>>,
+                      "Asynchronous nodes need schedule()");
+        auto inputs = hana::transform(hana::at_c<1>(item), [&ec](auto in) {
+            if constexpr (hana::is_a<sch::input_tag>(in)) {
+                return hana::at_key(ec, in.name);
+            }
+            else {
+                return *ec.wave_value[source_t<decltype(in)>{}];
+            }
+        });
+        ec.wave_value[key] = hana::unpack(
+              inputs, skip_empty<Key>(instrumented<Key>(
+                            pick_inputs(hana::at_c<1>(item), hana::at_c<2>(item)))));
+    }
+    template <class EC> static auto wave_table() {
+        std::array<void (*)(Sched&, EC&), n_nodes> table{};
+        hana::for_each(Keys{}, [&table](auto key) {
+            using Key = decltype(key);
+            table[index_of<Key>()] = [](Sched& self, EC& ec) { self.run_now(ec, Key{}); };
+        });
+        return table;
+    }
+
+  public:
+    // Lockstep engine for batches of events with the same shape. The nodes the required outputs
+    // need are split into levels and dealt to n_workers ahead of time (see WavePlan.h); each
+    // worker then runs its slots for the whole batch, level by level, with a barrier in between.
+    // No futures or dependency counts are involved. Returns once the batch is done: the
+    // outputs' slots hold ready futures and the intermediates that are pointers have been freed,
+    // so cleanup() is not needed.
+    template <class EC> bool schedule_waves(const std::vector<EC*>& batch, std::size_t n_workers) {
+        if (batch.empty()) {
+            return true;
+        }
+        if (wave_plan_stale || wave_plan.n_workers != n_workers
+            || wave_plan.n_events != batch.size()) {
+            wave_plan = make_wave_plan(shape(), n_workers, batch.size());
+            wave_plan_stale = false;
+        }
+        static const auto run_node = wave_table<EC>();
+        const auto start = std::chrono::steady_clock::now();
+        mem_stats.events_started(batch.size());
+        hpx::barrier<> barrier(n_workers);
+        auto work = [this, &batch, &barrier](std::size_t worker) {
+            for (const auto& level : wave_plan.levels) {
+                for (const auto& slot : level[worker]) {
+                    for (std::size_t e = slot.first_event; e < slot.last_event; ++e) {
+                        run_node[slot.node](*this, *batch[e]);
+                    }
+                }
+                barrier.arrive_and_wait();
+            }
+        };
+        std::vector<hpx::future<void>> others{};
+        for (std::size_t worker = 1; worker < n_workers; ++worker) {
+            others.push_back(hpx::async(work, worker));
+        }
+        work(0);
+        hpx::wait_all(others);
+        // Every event of the batch is done when the last worker is
+        const auto latency = std::chrono::steady_clock::now() - start;
+        for (std::size_t e = 0; e < batch.size(); ++e) {
+            latencies.record(latency);
+        }
+
+        for (EC* ec : batch) {
+            hana::for_each(Keys{}, [this, ec](auto key) {
+                auto& value = ec->wave_value[key];
+                if (!value) {
+                    return;
+                }
+                if (hana::at_c<3>(definitions[key])) {
+                    hana::at_c<4>(definitions[key])(*ec) = new hpx::shared_future{
+                          hpx::make_ready_future(std::move(*value))};
+                }
+                else if constexpr (owns_memory_v<slot_value<decltype(key)>>) {
+                    auto* ptr = owned_ptr(*value);
+                    mem_stats.released(index_of<decltype(key)>(), bytes_of(ptr));
+                    delete ptr;
+                }
+                value.reset();
+            });
+        }
+        mem_stats.events_finished(batch.size());
         return true;
     }
 
@@ -115,7 +778,7 @@ template <class... Defs> class Sched {
     template <typename EC> auto cleanup(EC& ec) {
         return [this, &ec](auto&& /* future */) {
             // Delete any intermediate values if they are pointers to free memory
-            auto delete_intermediates = [&ec](auto&& item) {
+            auto delete_intermediates = [this, &ec](auto&& item) {
                 constexpr auto is_required = hana::reverse_partial(hana::at, hana::size_c<3>);
                 if (!is_required(item)) {
                     auto* fut = hana::at_c<4>(item)(ec);
@@ -123,14 +786,17 @@ template <class... Defs> class Sched {
                         return;
                     }
                     auto& val = fut->get();
-                    if constexpr (std::is_pointer_v<std::remove_reference_t<decltype(val)>>) {
-                        if (val) {
-                            delete val;
+                    if constexpr (owns_memory_v<std::decay_t<decltype(val)>>) {
+                        if (auto* ptr = owned_ptr(val)) {
+                            using Key = std::decay_t<decltype(hana::at_c<0>(item))>;
+                            mem_stats.released(index_of<Key>(), bytes_of(ptr));
+                            delete ptr;
                         }
                     }
                 }
             };
             hana::for_each(hana::values(definitions), delete_intermediates);
+            mem_stats.events_finished();
         };
     }
 };
@@ -0,0 +1,94 @@
+// -*-c++-*-
+#ifndef OLDESTFIRST_H
+#define OLDESTFIRST_H
+// Runs the ready nodes of the oldest event first, whatever order HPX's queues hold them in
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <hpx/async_base/async.hpp>
+#include <hpx/local/future.hpp>
+#include <hpx/synchronization/spinlock.hpp>
+#include <hpx/threading_base/thread_priority.hpp>
+
+namespace sch {
+// Submitted tasks go into a heap ordered by event sequence number, and a runner task is started
+// for each. A runner does not run the task it was started for, but whichever one is the oldest
+// when it gets a worker: HPX only decides when tasks run, the heap which ones. There is one heap
+// per lane, a thread pool and priority, and runners are started in their task's lane and only
+// take tasks from it, so ordering does not move tasks off their node's pool or priority. The
+// queue must outlive the tasks submitted to it.
+class OldestFirst {
+  public:
+    // Where a task runs: the name of its node's pool (empty for the default pool) and priority
+    using Lane = std::pair<std::string, hpx::threads::thread_priority>;
+
+  private:
+    struct Task {
+        std::uint64_t seq;
+        std::function<void()> run;
+    };
+    using Heap = std::vector<Task>;
+    std::map<Lane, Heap> heaps{}; // Nodes of a std::map stay put, so runners can hold a Heap*
+    hpx::spinlock mtx{};
+
+    // Heap order: the top is the lowest sequence number
+    static bool runs_later(const Task& a, const Task& b) { return a.seq > b.seq; }
+
+    void run_oldest(Heap* heap) {
+        std::unique_lock lock{mtx};
+        std::pop_heap(heap->begin(), heap->end(), runs_later);
+        Task task = std::move(heap->back());
+        heap->pop_back();
+        lock.unlock();
+        task.run();
+    }
+
+  public:
+    OldestFirst() = default;
+    OldestFirst(const OldestFirst&) = delete;
+    OldestFirst& operator=(const OldestFirst&) = delete;
+
+    // Future to func(), run in lane once no older task of the lane is waiting. how (an executor
+    // or launch policy) starts the runner, and must put it on the lane's pool and priority.
+    template <class How, class Func> auto submit(std::uint64_t seq, Lane lane, How how, Func func) {
+        using R = std::invoke_result_t<Func>;
+        auto promise = std::make_shared<hpx::promise<R>>();
+        auto fut = promise->get_future();
+        auto run = [promise, func = std::move(func)]() mutable {
+            try {
+                if constexpr (std::is_void_v<R>) {
+                    func();
+                    promise->set_value();
+                }
+                else {
+                    promise->set_value(func());
+                }
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        };
+        Heap* heap = nullptr;
+        {
+            std::lock_guard lock{mtx};
+            heap = &heaps[std::move(lane)];
+            heap->push_back(Task{seq, std::move(run)});
+            std::push_heap(heap->begin(), heap->end(), runs_later);
+        }
+        hpx::async(how, [this, heap] { run_oldest(heap); });
+        return fut;
+    }
+};
+} // namespace sch
+
+#endif /* OLDESTFIRST_H */
@@ -1,19 +1,48 @@
+#include <algorithm>
 #include <chrono>
-#include <deque>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "Autotuner.h"
+#include "EvtColumns.h"
+#include "EvtPool.h"
 #include "HPXSched.h"
 #include <fmt/chrono.h>
 #include <fmt/format.h>
-#include <hpx/wrap_main.hpp>
+#include <hpx/include/performance_counters.hpp>
+#include <hpx/include/resource_partitioner.hpp>
+#include <hpx/init.hpp>
 
+#ifdef EIGEN_MTRX_ROWS
+// Small matrices with inline storage instead of MKL
+#include "EigenMtrx.h"
+using Mtrx = EigenMtrx<EIGEN_MTRX_ROWS>;
+#else
 #include "CPUMtrx.h"
+#include "GemmBatcher.h"
 using Mtrx = CPUMtrx<1000>;
+#endif
 constexpr int n_evts_per_block = 3000;
 constexpr int n_evts_in_flight = 30;
+constexpr int max_evts_in_flight = 256; // Bound for the autotuner
 using namespace std::chrono_literals;
+constexpr int gemm_batch_size = 8;
+constexpr auto gemm_batch_window = 500us;
+// Threads of the pools the scalar nodes run on with the pools option
+constexpr std::size_t n_pool_threads = 2;
+
+#ifndef EIGEN_MTRX_ROWS
+// Set with the batch_gemm option: the products of different events then share
+// cblas_sgemm_batch calls
+std::unique_ptr<GemmBatcher<1000>> gemms{};
+#endif
 
 template <class R, class P> void busy_wait(std::chrono::duration<R, P> time) {
     // Busy waits for a given length of time.
@@ -22,6 +51,17 @@ template <class R, class P> void busy_wait(std::chrono::duration<R, P> time) {
     }
 }
 
+// Set with the select= option: events with an input below it are rejected before their
+// matrices are made
+long long min_input = std::numeric_limits<long long>::min();
+
+std::optional<long long> select_input(long long x) {
+    if (x < min_input) {
+        return std::nullopt;
+    }
+    return x;
+}
+
 Mtrx* make_mtrx(long long x) {
     Mtrx* mtrx = new Mtrx(x);
     return mtrx;
@@ -38,6 +78,13 @@ long long scal_plus(long long x, long long y) {
 }
 
 long long times(Mtrx* x, Mtrx* y) {
+#ifndef EIGEN_MTRX_ROWS
+    if (gemms) {
+        // get() suspends this task until the batch has run; the worker moves on to other nodes
+        float ans = gemms->multiply(*x, *y).get().norm();
+        return ans;
+    }
+#endif
     float ans = (*x * *y).norm();
     return ans;
 }
@@ -53,74 +100,261 @@ long long cube(long long x) {
     return x * x * x;
 }
 
-sch::Sched scheduler{
-      sch::Define("Matrix X"_s, hana::make_tuple("X"_in), make_mtrx),
-      sch::Define("Matrix Y"_s, hana::make_tuple("Y"_in), make_mtrx),
-      sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube),
-      sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube),
-      sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus),
-      sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times),
-      sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square),
-      sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square),
-      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s), scal_plus)};
-struct EvtCtx : public decltype(scheduler)::ECBase {
-    long long X = 5;
-    long long Y = 10;
+// The benchmark graph, making its matrices from x and y. With the pools option the cheap scalar
+// nodes get threads of their own, so the tail of an event whose product is done does not queue
+// behind the products of other events.
+template <class X, class Y> auto demo_nodes(X x, Y y) {
+    return hana::make_tuple(
+          sch::Define("Matrix X"_s, hana::make_tuple(x), make_mtrx),
+          sch::Define("Matrix Y"_s, hana::make_tuple(y), make_mtrx),
+          sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube, sch::pool("scalar")),
+          sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube, sch::pool("scalar")),
+          sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus),
+          // The product is ~N times the work of the other nodes, so its branch is the critical
+          // path
+          sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times,
+                      sch::cost(1000)),
+          sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square,
+                      sch::pool("scalar")),
+          sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square,
+                      sch::pool("scalar")),
+          sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s),
+                      scal_plus, sch::pool("scalar")));
+}
+auto make_sched = [](auto... defs) { return sch::Sched{defs...}; };
+
+sch::Sched scheduler = hana::unpack(demo_nodes("X"_in, "Y"_in), make_sched);
+// With the select= option, a pair of filters selects the events first: every other node is gated
+// by them, and skipped for rejected events. A graph of its own, so the default one is not gated.
+sch::Sched selecting_scheduler = hana::unpack(
+      hana::concat(hana::make_tuple(
+                         sch::Define("Selected X"_s, hana::make_tuple("X"_in), select_input),
+                         sch::Define("Selected Y"_s, hana::make_tuple("Y"_in), select_input)),
+                   demo_nodes("Selected X"_s, "Selected Y"_s)),
+      make_sched);
+
+template <class S> struct EvtCtx : public S::ECBase {
+    BOOST_HANA_DEFINE_STRUCT(EvtCtx, (long long, X), (long long, Y));
+    hpx::shared_future<void> cleanup{}; // Ready once the intermediates have been freed
 };
-BOOST_HANA_ADAPT_STRUCT(EvtCtx, X, Y);
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fmt::print("Usage: {} input_file\n", argv[0]);
+// Gives each pool the scheduler's nodes ask for n_pool_threads cores from the end of the
+// machine; the default pool keeps the rest
+void add_pools(hpx::resource::partitioner& rp, const hpx::program_options::variables_map&) {
+    std::vector<const hpx::resource::pu*> pus{};
+    for (const auto& domain : rp.numa_domains()) {
+        for (const auto& core : domain.cores()) {
+            pus.push_back(&core.pus().front());
+        }
+    }
+    // Both graphs ask for the same pools
+    for (const auto& name : scheduler.pool_names()) {
+        rp.create_thread_pool(name);
+        for (std::size_t i = 0; i < n_pool_threads && pus.size() > 1; ++i) {
+            rp.add_resource(*pus.back(), name);
+            pus.pop_back();
+        }
+    }
+}
+
+// Options of a run that apply to whichever graph it uses
+struct RunOptions {
+    bool perf = false;
+    bool oldest_first = false;
+    bool autotune = false;
+    double p99_cap = 0; // ms, 0 for none
+    double mem_cap = 0; // MiB, 0 for none
+};
+
+template <class S> void run(S& scheduler, const char* input_file, std::string_view engine,
+                            const RunOptions& opts) {
+    if (opts.perf) {
+        scheduler.enable_perf_counters();
     }
-    std::ifstream in{argv[1]};
-    std::deque<EvtCtx> evts{};
-    std::deque<hpx::shared_future<long long>> outputs{};
-    std::deque<hpx::shared_future<void>> cleanups{};
+    if (opts.oldest_first) {
+        scheduler.prioritize_oldest_events();
+    }
+    const std::size_t n_workers = hpx::resource::get_num_threads("default");
+    std::vector<EvtCtx<S>*> wave{};
+    // Live values for monitoring, e.g. --hpx:print-counter=/sch/live-bytes
+    hpx::performance_counters::install_counter_type(
+          "/sch/live-bytes", [&scheduler](bool) { return scheduler.memory().live_bytes(); },
+          "Memory held by intermediates of events in flight", "bytes");
+    hpx::performance_counters::install_counter_type(
+          "/sch/events-in-flight",
+          [&scheduler](bool) { return scheduler.memory().events_in_flight(); },
+          "Events scheduled whose cleanup has not finished");
+    sch::io::EventReader<EvtCtx<S>> reader{input_file};
+    sch::EvtPool<EvtCtx<S>> evts(opts.autotune ? max_evts_in_flight : n_evts_in_flight);
+    evts.set_limit(n_evts_in_flight);
+    // With autotune, every block is a tuning period: events in flight, and the GEMM batch size
+    // when batching, are adjusted for throughput under the caps
+    std::optional<sch::Autotuner> tuner{};
+    if (opts.autotune) {
+        std::vector<sch::TunedSetting> settings{{"in_flight", n_evts_in_flight, 4,
+                                                 max_evts_in_flight, 8}};
+#ifndef EIGEN_MTRX_ROWS
+        if (gemms) {
+            settings.push_back({"gemm_batch", gemm_batch_size, 1, 64, 2});
+        }
+#endif
+        tuner.emplace(std::move(settings));
+    }
+    volatile long long o = 0;
+    long long n_selected = 0;
+    // Called for the oldest event when its slot is needed again, and for every event at the end
+    auto consume = [&scheduler, &o, &n_selected](EvtCtx<S>& ec) {
+        ec.cleanup.wait();
+        const auto& ans = scheduler.retrieve(ec, "Add Squares"_s)->get();
+        if (sch::present(ans)) {
+            o = sch::unwrap(ans);
+            n_selected++;
+        }
+    };
 
     long long n_evts = 0;
     std::chrono::duration<float, std::milli> total_time = 0ms;
-    while (in.good()) {
-        EvtCtx ec_template{};
-        in >> ec_template.X >> ec_template.Y;
-        if (!in.good()) {
+    while (true) {
+        EvtCtx<S> ec_template{};
+        if (!reader.next(ec_template)) {
             break;
         }
         auto start_tm = std::chrono::steady_clock::now();
+        const auto block_latencies = scheduler.latency().snapshot();
         for (int i = 0; i < n_evts_per_block; ++i) {
-            EvtCtx& ec = evts.emplace_back();
-            ec = ec_template;
+            EvtCtx<S>& ec = evts.acquire(consume);
+            sch::assign_inputs(ec, ec_template);
             auto& final_ans = scheduler.retrieve(ec, "Add Squares"_s);
-            bool success = scheduler.schedule(ec);
-            outputs.push_back(*final_ans);
-            cleanups.emplace_back(final_ans->then(scheduler.cleanup(ec)));
             n_evts++;
-            if (n_evts % n_evts_in_flight == n_evts_in_flight - 1) {
-                hpx::wait_all(cleanups.begin(), cleanups.end());
-                cleanups.clear();
+            if (engine == "waves") {
+                // A wave frees its own intermediates. It holds as many events as the pool lets
+                // be in flight, so acquire() never hands out an event of a wave that has not
+                // run yet.
+                ec.cleanup = hpx::make_ready_future();
+                wave.push_back(&ec);
+                if (wave.size() == evts.limit()) {
+                    scheduler.schedule_waves(wave, n_workers);
+                    wave.clear();
+                }
+                continue;
             }
+            bool success = engine == "senders" ? scheduler.schedule_senders(ec, "Add Squares"_s)
+                                               : scheduler.schedule(ec);
+            ec.cleanup = final_ans->then(scheduler.cleanup(ec));
         }
         auto this_time = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
               std::chrono::steady_clock::now() - start_tm);
         total_time += this_time;
         fmt::print("Took {} to schedule {} events\n", this_time, n_evts_per_block);
+        // Events finished so far, to see the tail move while the run goes on
+        scheduler.latency().print("Event latency so far");
+        if (tuner) {
+            // The partial wave runs before the limit can change under it
+            scheduler.schedule_waves(wave, n_workers);
+            wave.clear();
+            const double p99_ms =
+                  scheduler.latency().percentile(0.99, block_latencies).count() / 1e6;
+            const double live_mib = scheduler.memory().live_bytes() / (1024. * 1024.);
+            const bool over_cap = (opts.p99_cap > 0 && p99_ms > opts.p99_cap)
+                                  || (opts.mem_cap > 0 && live_mib > opts.mem_cap);
+            tuner->update(n_evts_per_block / (this_time / 1s), over_cap);
+            evts.set_limit((*tuner)[0]);
+#ifndef EIGEN_MTRX_ROWS
+            if (gemms) {
+                gemms->set_batch_size((*tuner)[1]);
+            }
+#endif
+        }
     }
     fmt::print("Waiting for all events\n");
     auto start_tm = std::chrono::steady_clock::now();
-    hpx::wait_all(outputs.begin(), outputs.end());
+    scheduler.schedule_waves(wave, n_workers);
+    evts.consume_all(consume);
     auto extra_tm = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
           std::chrono::steady_clock::now() - start_tm);
     fmt::print("Took {} ({} average) extra waiting for all events\n", extra_tm, extra_tm / n_evts);
-    fmt::print("Took {} total ({} average) scheduling events\n", total_time, total_time / n_evts);
-    start_tm = std::chrono::steady_clock::now();
-    volatile long long o = 0;
-    for (auto&& out : outputs) {
-        o = out.get();
-    }
-    fmt::print("Took {} reading out futures\n",
-               std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
-                     std::chrono::steady_clock::now() - start_tm));
-    // wait for all cleanup to be done
-    hpx::wait_all(cleanups.begin(), cleanups.end());
-    return 0;
+    fmt::print("Took {} total ({} average) scheduling events with {}\n", total_time,
+               total_time / n_evts, engine);
+    fmt::print("{} of {} events passed the selection\n", n_selected, n_evts);
+    scheduler.print_latency();
+    if (tuner) {
+        tuner->print();
+    }
+    scheduler.print_memory();
+    scheduler.print_perf_counters();
+}
+
+int hpx_main(int argc, char* argv[]) {
+    // futures: one shared future and dataflow per node; senders: one sender per event;
+    // waves: batches of events run in lockstep from a static schedule
+    const std::string_view engine = argc >= 3 ? argv[2] : "futures";
+    if (argc < 2 || (engine != "futures" && engine != "senders" && engine != "waves")) {
+        fmt::print("Usage: {} input_file [futures|senders|waves] [batch_gemm] [oldest_first] "
+                   "[pools] [autotune] [p99_cap=ms] [mem_cap=MiB] [select=min_input] [perf]\n",
+                   argv[0]);
+        hpx::finalize();
+        return 1;
+    }
+    // Options after the engine
+    RunOptions opts{};
+    bool select = false;
+    for (int i = 3; i < argc; ++i) {
+        const std::string_view option = argv[i];
+        if (option == "perf") {
+            opts.perf = true;
+        }
+        else if (option == "oldest_first") {
+            opts.oldest_first = true;
+        }
+        else if (option == "pools") {
+            // Set up by main()
+        }
+        else if (option == "autotune") {
+            opts.autotune = true;
+        }
+        else if (option.substr(0, 8) == "p99_cap=") {
+            opts.p99_cap = std::stod(std::string{option.substr(8)});
+        }
+        else if (option.substr(0, 8) == "mem_cap=") {
+            opts.mem_cap = std::stod(std::string{option.substr(8)});
+        }
+        else if (option.substr(0, 7) == "select=") {
+            min_input = std::stoll(std::string{option.substr(7)});
+            select = true;
+        }
+#ifndef EIGEN_MTRX_ROWS
+        else if (option == "batch_gemm") {
+            gemms = std::make_unique<GemmBatcher<1000>>(gemm_batch_size, gemm_batch_window);
+        }
+#endif
+        else {
+            fmt::print("Unknown option {}\n", option);
+            hpx::finalize();
+            return 1;
+        }
+    }
+#ifndef EIGEN_MTRX_ROWS
+    // A wave worker waits on one product at a time, so a batch would only fill with at least
+    // gemm_batch_size workers, and otherwise every product would sit out the batch window
+    if (engine == "waves" && gemms) {
+        fmt::print("batch_gemm does not work with the waves engine\n");
+        hpx::finalize();
+        return 1;
+    }
+#endif
+    if (select) {
+        run(selecting_scheduler, argv[1], engine, opts);
+    }
+    else {
+        run(scheduler, argv[1], engine, opts);
+    }
+    return hpx::finalize();
+}
+
+int main(int argc, char* argv[]) {
+    hpx::init_params params{};
+    if (std::find(argv + 1, argv + argc, std::string_view{"pools"}) != argv + argc) {
+        params.rp_callback = add_pools;
+    }
+    return hpx::init(argc, argv, params);
 }
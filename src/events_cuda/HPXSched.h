@@ -55,6 +55,16 @@ template <class... Defs> class Sched {
     struct ECBase {
         decltype(hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{})))
               slot = hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{}));
+
+        // Frees the futures of the last event so the context can be reused. Only call this once
+        // the event (and its cleanup) has finished.
+        void reset() {
+            hana::for_each(Keys{}, [this](auto key) {
+                auto& fut = slot[key];
+                delete fut;
+                fut = nullptr;
+            });
+        }
     };
 
     Sched(Defs... defs) : definitions(hana::make_map(defs...)) {}
@@ -122,7 +132,7 @@ template <class... Defs> class Sched {
             auto delete_intermediates = [&ec](auto&& item) {
                 constexpr auto is_required = hana::reverse_partial(hana::at, hana::size_c<3>);
                 if (!is_required(item)) {
-                    auto* fut = hana::at_c<4>(item)(ec);
+                    auto*& fut = hana::at_c<4>(item)(ec);
                     if (!fut || !fut->valid()) {
                         return;
                     }
@@ -133,6 +143,7 @@ template <class... Defs> class Sched {
                         }
                     }
                     delete fut;
+                    fut = nullptr;
                 }
             };
             hana::for_each(hana::values(definitions), delete_intermediates);
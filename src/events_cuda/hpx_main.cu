@@ -1,9 +1,10 @@
 #include <chrono>
-#include <deque>
 #include <fstream>
 #include <iostream>
 #include <thread>
 
+#include "EvtColumns.h"
+#include "EvtPool.h"
 #include "HPXSched.h"
 #include <fmt/chrono.h>
 #include <fmt/format.h>
@@ -69,6 +70,7 @@ sch::Sched scheduler{
 struct EvtCtx : public decltype(scheduler)::ECBase {
     long long X = 5;
     long long Y = 10;
+    hpx::future<void> cleanup{}; // Ready once the intermediates have been freed
 };
 BOOST_HANA_ADAPT_STRUCT(EvtCtx, X, Y);
 
@@ -79,32 +81,30 @@ int main(int argc, char* argv[]) {
 
     // setup CUDA
     setup();
-    std::ifstream in{argv[1]};
-    std::deque<EvtCtx> evts{};
-    std::deque<hpx::shared_future<long long>> outputs{};
-    std::deque<hpx::future<void>> cleanups{};
+    sch::io::EventReader<EvtCtx> reader{argv[1]};
+    sch::EvtPool<EvtCtx> evts{n_evts_in_flight};
+    volatile long long o = 0;
+    // Called for the oldest event when its slot is needed again, and for every event at the end
+    auto consume = [&o](EvtCtx& ec) {
+        ec.cleanup.wait();
+        o = scheduler.retrieve(ec, "Add Squares"_s)->get();
+    };
 
     long long n_evts = 0;
     std::chrono::duration<double, std::milli> total_time = 0ms;
-    while (in.good()) {
+    while (true) {
         EvtCtx ec_template{};
-        in >> ec_template.X >> ec_template.Y;
-        if (!in.good()) {
+        if (!reader.next(ec_template)) {
             break;
         }
         auto start_tm = std::chrono::steady_clock::now();
         for (int i = 0; i < n_evts_per_block; ++i) {
-            EvtCtx& ec = evts.emplace_back();
-            ec = ec_template;
+            EvtCtx& ec = evts.acquire(consume);
+            sch::assign_inputs(ec, ec_template);
             auto& final_ans = scheduler.retrieve(ec, "Add Squares"_s);
             bool success = scheduler.schedule(ec);
-            outputs.push_back(*final_ans);
-            cleanups.emplace_back(final_ans->then(scheduler.cleanup(ec)));
+            ec.cleanup = final_ans->then(scheduler.cleanup(ec));
             n_evts++;
-            if (n_evts % n_evts_in_flight == n_evts_in_flight - 1) {
-                hpx::wait_all(cleanups.begin(), cleanups.end());
-                cleanups.clear();
-            }
         }
         auto this_time = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
               std::chrono::steady_clock::now() - start_tm);
@@ -113,21 +113,11 @@ int main(int argc, char* argv[]) {
     }
     fmt::print("Waiting for all events\n");
     auto start_tm = std::chrono::steady_clock::now();
-    hpx::wait_all(outputs.begin(), outputs.end());
+    evts.consume_all(consume);
     auto extra_tm = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
           std::chrono::steady_clock::now() - start_tm);
     fmt::print("Took {} ({} average) extra waiting for all events\n", extra_tm, extra_tm / n_evts);
     fmt::print("Took {} total ({} average) scheduling events\n", total_time, total_time / n_evts);
-    start_tm = std::chrono::steady_clock::now();
-    volatile long long o = 0;
-    for (auto&& out : outputs) {
-        o = out.get();
-    }
-    fmt::print("Took {} reading out futures\n",
-               std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
-                     std::chrono::steady_clock::now() - start_tm));
-    // wait for all cleanup to be done
-    hpx::wait_all(cleanups.begin(), cleanups.end());
 
     // cleanup CUDA
     // teardown();
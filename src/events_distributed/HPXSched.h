@@ -1,7 +1,18 @@
 // -*-c++-*-
 #ifndef HPXSCHED_H
 #define HPXSCHED_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -13,11 +24,20 @@
 namespace hana = boost::hana;
 using namespace hana::literals;
 
+#include <hpx/async_combinators/split_future.hpp>
+#include <hpx/async_combinators/when_any.hpp>
 #include <hpx/async_distributed/async.hpp>
 #include <hpx/async_distributed/dataflow.hpp>
+#include <hpx/include/components.hpp>
 #include <hpx/runtime.hpp>
 #include <hpx/local/future.hpp>
+#include <hpx/local/thread.hpp>
 #include <hpx/pack_traversal/unwrap.hpp>
+#include <hpx/serialization/tuple.hpp>
+#include <hpx/serialization/vector.hpp>
+#include <hpx/synchronization/spinlock.hpp>
+
+#include "NodeOpts.h"
 
 namespace sch {
 class input_tag {};
@@ -27,15 +47,51 @@ template <class HS> struct Input {
 
     constexpr Input(HS name) : name(name) {}
 };
-template <class Key, class Inputs, class Func> auto Define(Key key, Inputs inputs, Func func) {
+// A value kept on the locality that produced it, as an HPX component. Nodes return
+// keep_here(value) instead of the value and downstream nodes get its hpx::id_type; the value
+// is freed once the last copy of the id goes away. Each T needs SCH_REGISTER_RESIDENT(T, name)
+// in one translation unit.
+template <class T> struct Resident : hpx::components::component_base<Resident<T>> {
+    T value;
+
+    Resident() = default;
+    explicit Resident(T value) : value(std::move(value)) {}
+
+    T get() const { return value; }
+    HPX_DEFINE_COMPONENT_ACTION(Resident, get, get_action);
+};
+
+template <class T> hpx::id_type keep_here(T value) {
+    return hpx::local_new<Resident<T>>(std::move(value)).get();
+}
+
+// The value behind id: copied from the component when it lives here, otherwise sent over. For
+// large values, make T a shared_ptr so the local copy is cheap.
+template <class T> T fetch(const hpx::id_type& id) {
+    if (hpx::get_colocation_id(hpx::launch::sync, id) == hpx::find_here()) {
+        return hpx::get_ptr<Resident<T>>(hpx::launch::sync, id)->value;
+    }
+    return hpx::async<typename Resident<T>::get_action>(id).get();
+}
+
+// Where a node placed with Placement::follow_data runs
+enum class Placement {
+    fixed,      // On the locality passed to schedule
+    follow_data // On the locality holding most of its resident inputs
+};
+
+template <class Key, class Inputs, class Func, class... Opts>
+auto Define(Key key, Inputs inputs, Func func, Opts... opts) {
     static_assert(hana::is_a<hana::string_tag>(key), "Define's key must be a hana::string");
     static_assert(hana::Sequence<Inputs>::value, "Define's inputs must be a tuple");
     using func_ret_t = typename hpx::traits::extract_action<Func>::result_type;
     using fut_p = hpx::shared_future<func_ret_t>*;
-    // Tuple items are: key, inputs tuple, function to calculate, required, func returning ref-to-ptr-to-future, prototype ptr-to-future
+    // Tuple items are: key, inputs tuple, function to calculate, func returning
+    // ref-to-ptr-to-future, prototype ptr-to-future, node options
     return hana::make_pair(key, hana::make_tuple(
-                               key, inputs, func, false,
-                                      [](auto& ec) -> fut_p& { return ec.slot[Key{}]; }, fut_p{}));
+                               key, inputs, func,
+                               [](auto& ec) -> fut_p& { return ec.slot[Key{}]; }, fut_p{},
+                               make_node_opts(opts...)));
 }
 
 template <class... Defs> class Sched {
@@ -43,35 +99,192 @@ template <class... Defs> class Sched {
     hana::map<Defs...> definitions;
     using Keys = decltype(hana::keys(definitions));
     using FutTypes = decltype(hana::transform(hana::values(definitions),
-                                              hana::reverse_partial(hana::at, hana::size_c<5>)));
+                                              hana::reverse_partial(hana::at, hana::size_c<4>)));
+    static constexpr std::size_t n_nodes = hana::length(Keys{});
+    using clock = std::chrono::steady_clock;
+
+    template <class Key> static constexpr std::size_t index_of() {
+        using index_t = decltype(hana::index_if(Keys{}, hana::equal.to(Key{})).value());
+        return std::decay_t<index_t>::value;
+    }
+
+    // Moving average of how long each node takes, from the call until its value is back, for
+    // speculative backups
+    struct alignas(64) Duration {
+        std::atomic<double> mean{0}; // Seconds
+        std::atomic<std::uint64_t> samples{0};
+    };
+    static constexpr std::uint64_t min_backup_samples = 16;
+    std::array<Duration, n_nodes> durations{};
+    double backup_factor = 0; // Backups are off while 0
+    clock::duration min_backup_delay{};
+    std::vector<hpx::id_type> backup_localities{};
+    std::atomic<std::uint64_t> n_backups{0};
+    std::array<std::atomic<bool>, n_nodes> required{}; // Nodes whose value has been retrieved
+
+    void record_duration(std::size_t k, clock::duration elapsed) {
+        auto& d = durations[k];
+        const auto n = d.samples.fetch_add(1, std::memory_order_relaxed) + 1;
+        // Plain mean over the first samples, then an exponential moving average
+        const double weight = std::max(1.0 / n, 0.05);
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        double old = d.mean.load(std::memory_order_relaxed);
+        while (!d.mean.compare_exchange_weak(old, old + weight * (seconds - old),
+                                             std::memory_order_relaxed)) {
+        }
+    }
+
+    // Runs func on locality. With backups enabled and the node pure, a copy is started on the
+    // next locality once the call has taken backup_factor times the node's average, and the
+    // first of the two to finish provides the value. The other one runs to completion (remote
+    // calls cannot be cancelled) and its value is dropped.
+    template <class Key, class Func, class... Args>
+    auto run_node(Func func, hpx::id_type locality, Args... args) {
+        using R = typename hpx::traits::extract_action<Func>::result_type;
+        if (backup_factor == 0) {
+            return hpx::async(func, locality, args...);
+        }
+        constexpr std::size_t k = index_of<Key>();
+        const auto start = clock::now();
+        hpx::shared_future<R> primary = hpx::async(func, locality, args...);
+        auto timed = [this, start](auto&& fut) {
+            record_duration(k, clock::now() - start);
+            return fut.get();
+        };
+        const auto& d = durations[k];
+        if (!hana::at_c<5>(definitions[Key{}]).pure
+            || d.samples.load(std::memory_order_relaxed) < min_backup_samples) {
+            return primary.then(timed);
+        }
+        const auto delay = std::max(
+              min_backup_delay, std::chrono::duration_cast<clock::duration>(std::chrono::duration<
+                                      double>(backup_factor * d.mean.load())));
+        auto raced = hpx::when_any(primary, hpx::make_ready_future_after(delay))
+                           .then([this, func, locality, primary, args...](auto&&) {
+                               if (primary.is_ready()) {
+                                   return hpx::make_ready_future(primary.get());
+                               }
+                               ++n_backups;
+                               hpx::shared_future<R> backup =
+                                     hpx::async(func, next_locality(locality), args...);
+                               return hpx::when_any(primary, backup).then([](auto&& any) {
+                                   auto result = any.get();
+                                   return result.index == 0 ? hpx::get<0>(result.futures).get()
+                                                            : hpx::get<1>(result.futures).get();
+                               });
+                           });
+        return hpx::future<R>{std::move(raced)}.then(timed);
+    }
+
+    // Where backups of calls to locality go: the next locality, or the same one (and another
+    // worker) when there is only one
+    hpx::id_type next_locality(const hpx::id_type& locality) const {
+        auto it = std::find(backup_localities.begin(), backup_localities.end(), locality);
+        if (it == backup_localities.end() || ++it == backup_localities.end()) {
+            it = backup_localities.begin();
+        }
+        return *it;
+    }
 
   public:
     struct ECBase {
         decltype(hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{})))
               slot = hana::to_map(hana::zip_with(hana::make_pair, Keys{}, FutTypes{}));
+
+        // Frees the futures of the last event so the context can be reused
+        void reset() {
+            hana::for_each(Keys{}, [this](auto key) {
+                auto& fut = slot[key];
+                delete fut;
+                fut = nullptr;
+            });
+        }
     };
 
+    // The inputs of an event context (the members exposed through BOOST_HANA_ADAPT_STRUCT) packed
+    // into a std::tuple, so that they can be sent to another locality in a single parcel
+    template <class EC> static auto pack_inputs(const EC& ec) {
+        return hana::unpack(hana::members(ec), [](auto&&... m) { return std::make_tuple(m...); });
+    }
+    template <class EC> using packed_inputs_t = decltype(pack_inputs(std::declval<const EC&>()));
+    template <class EC, class Packed> static void unpack_inputs(EC& ec, const Packed& packed) {
+        constexpr auto accessors = hana::accessors<EC>();
+        hana::for_each(hana::make_range(hana::size_c<0>, hana::length(accessors)), [&](auto i) {
+            hana::second(hana::at(accessors, i))(ec) = std::get<decltype(i)::value>(packed);
+        });
+    }
+
     Sched(Defs... defs) : definitions(hana::make_map(defs...)) {}
     template <typename Key> auto& retrieve(ECBase& ec, Key key) {
         static_assert(!hana::is_a<sch::input_tag>(key), "Cannot 'retrieve' an input");
-        hana::at_c<3>(definitions[key]) = true;     // Record that we need to calculate this value
-        return hana::at_c<4>(definitions[key])(ec); // Return reference to pointer to future
+        // Record that we need to calculate this value. Remote calls (run_here, run_batch_here)
+        // retrieve concurrently, hence the atomic flags.
+        required[index_of<Key>()].store(true, std::memory_order_relaxed);
+        return hana::at_c<3>(definitions[key])(ec); // Return reference to pointer to future
+    }
+
+    // Straggler mitigation for schedule(): once a node marked sch::pure() has run
+    // min_backup_samples times, a call that takes more than factor times its moving average
+    // (and at least min_delay) gets a backup copy on another locality, and the first result
+    // wins. Call before scheduling anything.
+    void enable_backups(double factor = 4,
+                        clock::duration min_delay = std::chrono::milliseconds(1)) {
+        backup_factor = factor;
+        min_backup_delay = min_delay;
+        backup_localities = hpx::find_all_localities();
+    }
+
+    // Backup copies started so far
+    std::uint64_t backups() const { return n_backups.load(); }
+
+    // The values of keys, as returned by run_here
+    template <class EC, class... Keys>
+    using results_t = std::tuple<std::decay_t<
+          decltype(std::declval<Sched&>().retrieve(std::declval<EC&>(), Keys{})->get())>...>;
+
+  private:
+    // Locality that holds most of the resident inputs (the hpx::id_type arguments) of a node,
+    // or fallback if it has none
+    template <class... Args>
+    static hpx::id_type owner_of(const hpx::id_type& fallback, const Args&... args) {
+        std::vector<hpx::id_type> owners{};
+        auto add_owner = [&owners](const auto& arg) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, hpx::id_type>) {
+                owners.push_back(hpx::get_colocation_id(hpx::launch::sync, arg));
+            }
+        };
+        (add_owner(args), ...);
+        hpx::id_type best = fallback;
+        std::ptrdiff_t best_count = 0;
+        for (const auto& owner : owners) {
+            auto count = std::count(owners.begin(), owners.end(), owner);
+            if (count > best_count) {
+                best = owner;
+                best_count = count;
+            }
+        }
+        return best;
     }
 
+  public:
     // This function does the scheduling (and running)
     // For now, lets use HPX
-    template <typename EC> bool schedule(EC& ec, hpx::id_type locality = hpx::find_here()) {
+    // With Placement::follow_data, nodes with resident inputs run where most of those inputs
+    // live, so large intermediates stay put and only handles and small results travel; the
+    // other nodes run on locality.
+    template <typename EC>
+    bool schedule(EC& ec, hpx::id_type locality = hpx::find_here(),
+                  Placement placement = Placement::fixed) {
         constexpr auto dataflow = BOOST_HOF_LIFT(hpx::dataflow);
-        constexpr auto is_required = hana::reverse_partial(hana::at, hana::size_c<3>);
         // Given a key, schedule the computation for that value
-        auto run = hana::fix([this, &dataflow, &ec, &locality](auto self, auto key) {
+        auto run = hana::fix([this, &dataflow, &ec, &locality, placement](auto self, auto key) {
             if constexpr (hana::is_a<sch::input_tag>(key)) {
                 hpx::shared_future fut = hpx::make_ready_future(hana::at_key(ec, key.name));
                 return fut;
             }
             else {
                 auto& item = this->definitions[key];
-                auto& res = hana::at_c<4>(item)(ec);
+                auto& res = hana::at_c<3>(item)(ec);
                 if (res) {
                     // Already scheduled
                     // Return future for use in downstream calculations
@@ -82,22 +295,37 @@ template <class... Defs> class Sched {
                 auto func = hana::at_c<2>(item);
                 if constexpr (hana::is_empty(inputs)) {
                     // fmt::print("Scheduling {} with no inputs\n", key.c_str());
-                    res = new hpx::shared_future{hpx::async(func, locality)};
+                    res = new hpx::shared_future{run_node<decltype(key)>(func, locality)};
                 }
                 else {
                     // Schedule every input
                     auto input_res = hana::transform(inputs, self);
                     // fmt::print("Scheduling calculation of {} with inputs\n", key.c_str());
-                    res = new hpx::shared_future{hana::unpack(
-                          input_res, hana::partial(dataflow, hpx::unwrapping(func), locality))};
+                    if (placement == Placement::follow_data || backup_factor != 0) {
+                        // The locality is only known once the inputs are
+                        auto route = [this, func, locality, placement](auto... args) {
+                            const auto where = placement == Placement::follow_data
+                                                     ? owner_of(locality, args...)
+                                                     : locality;
+                            return run_node<decltype(key)>(func, where, args...);
+                        };
+                        using R = typename hpx::traits::future_traits<
+                              std::remove_pointer_t<std::decay_t<decltype(res)>>>::type;
+                        auto routed = hana::unpack(
+                              input_res, hana::partial(dataflow, hpx::unwrapping(route)));
+                        res = new hpx::shared_future<R>{hpx::future<R>{std::move(routed)}};
+                    }
+                    else {
+                        res = new hpx::shared_future{hana::unpack(
+                              input_res, hana::partial(dataflow, hpx::unwrapping(func), locality))};
+                    }
                 }
                 // Return future to be used as input in downstream calculations
                 return *res;
             }
         });
-        auto run_if_required = [this, &run, &is_required](auto key) {
-            auto& item = this->definitions[key];
-            if (!is_required(item)) {
+        auto run_if_required = [this, &run](auto key) {
+            if (!required[index_of<decltype(key)>()].load(std::memory_order_relaxed)) {
                 return;
             }
             // fmt::print("\n{} is required -- scheduling\n", key.c_str());
@@ -106,10 +334,271 @@ template <class... Defs> class Sched {
         hana::for_each(hana::keys(definitions), run_if_required);
         return true;
     }
+
+    // Runs the whole subgraph needed for `keys` on this locality and returns their values.
+    // This is meant to be the body of a plain action, which schedule_subgraph then calls.
+    template <class EC, class... Keys>
+    auto run_here(const packed_inputs_t<EC>& packed, Keys... keys) {
+        EC ec{};
+        unpack_inputs(ec, packed);
+        (retrieve(ec, keys), ...);
+        schedule(ec, hpx::find_here());
+        auto result = std::make_tuple(retrieve(ec, keys)->get()...);
+        ec.reset();
+        return result;
+    }
+
+    // Ships the inputs of ec to locality in one parcel, where Action (wrapping run_here with the
+    // same keys) runs every node. Only the values of keys travel back; they are placed in the
+    // slots of ec, so retrieve works as it does with schedule.
+    template <class Action, class EC, class... Keys>
+    bool schedule_subgraph(EC& ec, hpx::id_type locality, Keys... keys) {
+        assign_results(ec, hpx::async<Action>(locality, pack_inputs(ec)), keys...);
+        return true;
+    }
+
+    // Runs a batch of events on this locality; the body of the action used by a RemoteBatcher.
+    // Every event is scheduled before any result is read, so the batch runs in parallel.
+    template <class EC, class... Keys>
+    auto run_batch_here(const std::vector<packed_inputs_t<EC>>& batch, Keys... keys) {
+        std::vector<EC> ecs(batch.size());
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            unpack_inputs(ecs[i], batch[i]);
+            (retrieve(ecs[i], keys), ...);
+            schedule(ecs[i], hpx::find_here());
+        }
+        std::vector<results_t<EC, Keys...>> results;
+        results.reserve(batch.size());
+        for (auto& ec : ecs) {
+            results.emplace_back(retrieve(ec, keys)->get()...);
+            ec.reset();
+        }
+        return results;
+    }
+
+    // Runs a batch of events on this locality like run_batch_here, but instead of returning
+    // the values of key, adds each to sink as soon as it is ready
+    template <class EC, class Sink, class Key>
+    std::size_t run_batch_into(Sink& sink, const std::vector<packed_inputs_t<EC>>& batch, Key key) {
+        std::vector<EC> ecs(batch.size());
+        std::vector<hpx::future<void>> added{};
+        added.reserve(batch.size());
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            unpack_inputs(ecs[i], batch[i]);
+            auto& res = retrieve(ecs[i], key);
+            schedule(ecs[i], hpx::find_here());
+            added.push_back(res->then([&sink](auto&& f) { sink.add(f.get()); }));
+        }
+        hpx::wait_all(added.begin(), added.end());
+        for (auto& ec : ecs) {
+            ec.reset();
+        }
+        return batch.size();
+    }
+
+    // Queues ec on batcher; it is sent to locality together with other events bound there
+    template <class Batcher, class EC, class... Keys>
+    bool schedule_batched(Batcher& batcher, EC& ec, hpx::id_type locality, Keys... keys) {
+        assign_results(ec, batcher.submit(locality, pack_inputs(ec)), keys...);
+        return true;
+    }
+
+    // Splits a future to the tuple of values of keys into the slots of ec
+    template <class EC, class Results, class... Keys>
+    void assign_results(EC& ec, hpx::future<Results>&& results, Keys... keys) {
+        auto split = hpx::split_future(std::move(results));
+        auto key_tuple = hana::make_tuple(keys...);
+        hana::for_each(hana::make_range(hana::size_c<0>, hana::size(key_tuple)), [&](auto i) {
+            auto& res = retrieve(ec, hana::at(key_tuple, i));
+            res = new hpx::shared_future{std::move(std::get<decltype(i)::value>(split))};
+        });
+    }
+
+
+};
+
+// Collects events bound for the same locality and sends them with a single call to Action,
+// which takes a std::vector<Packed> and returns a std::vector<Result> (see run_batch_here).
+// A locality's batch is sent once it holds batch_size events, or flush_timeout after its first
+// event was queued, by a timer task started with that event. Batches are sent outside the lock,
+// so submitters to other localities do not wait on the call.
+template <class Action, class Packed, class Result> class RemoteBatcher {
+  private:
+    using clock = std::chrono::steady_clock;
+    struct Pending {
+        std::vector<Packed> inputs{};
+        std::vector<hpx::promise<Result>> promises{};
+    };
+    struct Queue {
+        Pending pending{};
+        std::size_t generation = 0; // Number of batches taken so far
+    };
+    std::size_t batch_size;
+    clock::duration flush_timeout;
+    std::unordered_map<hpx::id_type, Queue> queues{};
+    hpx::spinlock mtx{};
+    std::atomic<std::size_t> timers{0}; // Timer tasks that have not finished
+
+    Pending take_locked(Queue& q) {
+        ++q.generation;
+        Pending batch = std::move(q.pending);
+        q.pending = Pending{};
+        q.pending.inputs.reserve(batch_size);
+        q.pending.promises.reserve(batch_size);
+        return batch;
+    }
+
+    void send(hpx::id_type locality, Pending&& batch) {
+        if (batch.inputs.empty()) {
+            return;
+        }
+        auto results = hpx::async<Action>(locality, std::move(batch.inputs));
+        results.then([promises = std::move(batch.promises)](auto&& f) mutable {
+            try {
+                auto values = f.get();
+                for (std::size_t i = 0; i < promises.size(); ++i) {
+                    promises[i].set_value(std::move(values[i]));
+                }
+            }
+            catch (...) {
+                for (auto& promise : promises) {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+        });
+    }
+
+    // Sends the batch that was pending for locality when the timer was started, unless it
+    // already went
+    void flush(hpx::id_type locality, std::size_t batch_generation) {
+        std::unique_lock lock{mtx};
+        Queue& q = queues[locality];
+        if (q.generation != batch_generation || q.pending.inputs.empty()) {
+            return;
+        }
+        Pending batch = take_locked(q);
+        lock.unlock();
+        send(locality, std::move(batch));
+    }
+
+  public:
+    RemoteBatcher(std::size_t batch_size, clock::duration flush_timeout)
+          : batch_size(batch_size), flush_timeout(flush_timeout) {}
+    RemoteBatcher(const RemoteBatcher&) = delete;
+    RemoteBatcher& operator=(const RemoteBatcher&) = delete;
+    // Waits for the timer tasks, which refer to the batcher
+    ~RemoteBatcher() {
+        while (timers.load() > 0) {
+            hpx::this_thread::yield();
+        }
+    }
+
+    hpx::future<Result> submit(hpx::id_type locality, Packed inputs) {
+        std::unique_lock lock{mtx};
+        Queue& q = queues[locality];
+        q.pending.inputs.push_back(std::move(inputs));
+        auto fut = q.pending.promises.emplace_back().get_future();
+        if (q.pending.inputs.size() >= batch_size) {
+            Pending batch = take_locked(q);
+            lock.unlock();
+            send(locality, std::move(batch));
+        }
+        else if (q.pending.inputs.size() == 1) {
+            const std::size_t batch_generation = q.generation;
+            lock.unlock();
+            // Sleeping suspends the timer task, not the worker running it
+            timers.fetch_add(1);
+            hpx::async([this, locality, batch_generation] {
+                hpx::this_thread::sleep_for(flush_timeout);
+                flush(locality, batch_generation);
+                timers.fetch_sub(1);
+            });
+        }
+        return fut;
+    }
+
+    void flush_all() {
+        std::vector<std::pair<hpx::id_type, Pending>> batches{};
+        {
+            std::lock_guard lock{mtx};
+            for (auto& [locality, q] : queues) {
+                batches.emplace_back(locality, take_locked(q));
+            }
+        }
+        for (auto& [locality, batch] : batches) {
+            send(locality, std::move(batch));
+        }
+    }
 };
 
+// Reduces the results of the events run on this locality as they arrive, so that they need not
+// be kept on the root. Partials from several localities are merged with tree_gather.
+template <class T, class Op = std::plus<T>> class LocalSink {
+  public:
+    struct Partial {
+        std::size_t count{0};
+        T value{};
+
+        template <class Archive> void serialize(Archive& ar, const unsigned int) {
+            ar& count& value;
+        }
+    };
+
+  private:
+    T init;
+    Op op;
+    Partial acc;
+    hpx::spinlock mtx{};
+
+  public:
+    explicit LocalSink(T init = T{}, Op op = Op{}) : init(init), op(op), acc{0, init} {}
+
+    void add(const T& value) {
+        std::lock_guard lock{mtx};
+        acc.value = op(acc.value, value);
+        ++acc.count;
+    }
+
+    Partial combine(Partial lhs, const Partial& rhs) const {
+        lhs.value = op(lhs.value, rhs.value);
+        lhs.count += rhs.count;
+        return lhs;
+    }
+
+    // Returns everything added so far and starts again from init
+    Partial take() {
+        std::lock_guard lock{mtx};
+        return std::exchange(acc, Partial{0, init});
+    }
+};
+
+// Merges a partial result from every locality up a binary tree rooted at locality 0: the
+// locality with index rank combines its own partial with those of 2 * rank + 1 and 2 * rank + 2,
+// so no locality receives more than two messages. Action must be a plain action taking the rank
+// and calling tree_gather<Action> on the locality it runs on.
+template <class Action, class Partial, class Combine>
+Partial tree_gather(std::size_t rank, Partial local, Combine combine) {
+    std::vector localities = hpx::find_all_localities();
+    std::vector<hpx::future<Partial>> children{};
+    for (std::size_t child : {2 * rank + 1, 2 * rank + 2}) {
+        if (child < localities.size()) {
+            children.push_back(hpx::async<Action>(localities[child], child));
+        }
+    }
+    for (auto& child : children) {
+        local = combine(std::move(local), child.get());
+    }
+    return local;
+}
+
 } // namespace sch
 
+// Registers Resident<T> and its action; name must be a unique identifier
+#define SCH_REGISTER_RESIDENT(T, name)                                                            \
+    using name##_component = hpx::components::component<sch::Resident<T>>;                      \
+    HPX_REGISTER_COMPONENT(name##_component, name);                                               \
+    HPX_REGISTER_ACTION(sch::Resident<T>::get_action, name##_get_action)
+
 template <typename CharT, CharT... str> constexpr auto operator""_in() {
     return sch::Input{hana::string_c<str...>};
 }
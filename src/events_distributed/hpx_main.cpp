@@ -2,6 +2,7 @@
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <string_view>
 #include <thread>
 
 #include "HPXSched.h"
@@ -13,6 +14,9 @@
 #include <hpx/wrap_main.hpp>
 
 constexpr int n_evts_per_block = 30000;
+// Batched mode: events per parcel, and how long a partial batch may wait before it is sent
+constexpr std::size_t n_evts_per_batch = 1000;
+constexpr auto batch_flush_timeout = std::chrono::milliseconds(5);
 using namespace std::chrono_literals;
 
 template <> struct fmt::formatter<hpx::id_type> : ostream_formatter {};
@@ -53,29 +57,123 @@ long long cube_fn(long long x) {
 }
 HPX_PLAIN_ACTION(cube_fn, cube);
 
+// Every node is a pure function of its inputs, so stragglers can be backed up (backups option)
 sch::Sched scheduler{
-      sch::Define("Cube Plus"_s, hana::make_tuple("Ten plus Five"_s), cube{}),
-      sch::Define("Cube Times"_s, hana::make_tuple("Ten times Five"_s), cube{}),
-      sch::Define("Ten plus Five"_s, hana::make_tuple("Five"_in, "Ten"_in), plus{}),
-      sch::Define("Ten times Five"_s, hana::make_tuple("Five"_in, "Ten"_in), times{}),
-      sch::Define("Square Plus"_s, hana::make_tuple("Ten plus Five"_s), square{}),
-      sch::Define("Square Times"_s, hana::make_tuple("Ten times Five"_s), square{}),
-      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s), plus{})};
+      sch::Define("Cube Plus"_s, hana::make_tuple("Ten plus Five"_s), cube{}, sch::pure()),
+      sch::Define("Cube Times"_s, hana::make_tuple("Ten times Five"_s), cube{}, sch::pure()),
+      sch::Define("Ten plus Five"_s, hana::make_tuple("Five"_in, "Ten"_in), plus{}, sch::pure()),
+      sch::Define("Ten times Five"_s, hana::make_tuple("Five"_in, "Ten"_in), times{},
+                  sch::pure()),
+      sch::Define("Square Plus"_s, hana::make_tuple("Ten plus Five"_s), square{}, sch::pure()),
+      sch::Define("Square Times"_s, hana::make_tuple("Ten times Five"_s), square{}, sch::pure()),
+      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s), plus{},
+                  sch::pure())};
 struct EvtCtx : public decltype(scheduler)::ECBase {
     long long Five = 5;
     long long Ten = 10;
 };
 BOOST_HANA_ADAPT_STRUCT(EvtCtx, Five, Ten);
 
+// Whole-event action used in subgraph mode: the inputs travel in one parcel, every node runs on
+// the receiving locality and only "Add Squares" is sent back
+auto run_event_fn(decltype(scheduler)::packed_inputs_t<EvtCtx> inputs) {
+    return scheduler.run_here<EvtCtx>(inputs, "Add Squares"_s);
+}
+HPX_PLAIN_ACTION(run_event_fn, run_event);
+
+// Batched mode: many events' inputs in one parcel, and their results in one reply
+auto run_batch_fn(std::vector<decltype(scheduler)::packed_inputs_t<EvtCtx>> batch) {
+    return scheduler.run_batch_here<EvtCtx>(batch, "Add Squares"_s);
+}
+HPX_PLAIN_ACTION(run_batch_fn, run_batch);
+
+// Sink mode: each locality sums its own results, and only the sums travel to the root
+sch::LocalSink<long long> sink{};
+std::size_t run_batch_sink_fn(std::vector<decltype(scheduler)::packed_inputs_t<EvtCtx>> batch) {
+    return scheduler.run_batch_into<EvtCtx>(sink, batch, "Add Squares"_s);
+}
+HPX_PLAIN_ACTION(run_batch_sink_fn, run_batch_sink);
+
+decltype(sink)::Partial gather_fn(std::size_t rank);
+HPX_PLAIN_ACTION(gather_fn, gather);
+decltype(sink)::Partial gather_fn(std::size_t rank) {
+    return sch::tree_gather<gather>(rank, sink.take(),
+                                    [](auto lhs, auto rhs) { return sink.combine(lhs, rhs); });
+}
+
+// Sink mode only keeps the acknowledgements of the current and previous block on the root
+int run_sink(std::ifstream& in, const std::vector<hpx::id_type>& localities) {
+    using Packed = decltype(scheduler)::packed_inputs_t<EvtCtx>;
+    std::deque<hpx::future<std::size_t>> prev_acks{};
+    std::deque<hpx::future<std::size_t>> acks{};
+    long long n_evts = 0;
+    std::chrono::duration<double, std::milli> total_time = 0ms;
+    int counter = 0;
+    while (in.good()) {
+        EvtCtx ec_template{};
+        in >> ec_template.Five >> ec_template.Ten;
+        if (!in.good()) {
+            break;
+        }
+        auto start_tm = std::chrono::steady_clock::now();
+        auto loc = localities[counter++ % localities.size()];
+        std::vector<Packed> batch{};
+        batch.reserve(n_evts_per_batch);
+        for (int i = 0; i < n_evts_per_block; ++i) {
+            batch.push_back(decltype(scheduler)::pack_inputs(ec_template));
+            if (batch.size() == n_evts_per_batch || i == n_evts_per_block - 1) {
+                acks.push_back(hpx::async<run_batch_sink>(loc, std::move(batch)));
+                batch = {};
+                batch.reserve(n_evts_per_batch);
+            }
+            n_evts++;
+        }
+        hpx::wait_all(prev_acks.begin(), prev_acks.end());
+        prev_acks = std::exchange(acks, {});
+        auto this_time = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
+              std::chrono::steady_clock::now() - start_tm);
+        total_time += this_time;
+        fmt::print("Took {} to schedule {} events\n", this_time, n_evts_per_block);
+    }
+    fmt::print("Waiting for all events\n");
+    auto start_tm = std::chrono::steady_clock::now();
+    hpx::wait_all(prev_acks.begin(), prev_acks.end());
+    fmt::print("Took {} extra waiting for all events\n",
+               std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1>>>(
+                     std::chrono::steady_clock::now() - start_tm));
+    fmt::print("Took {} total ({} average) scheduling events\n", total_time, total_time / n_evts);
+    start_tm = std::chrono::steady_clock::now();
+    auto total = hpx::async<gather>(localities[0], std::size_t{0}).get();
+    fmt::print("Took {} gathering {} results (sum {})\n",
+               std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
+                     std::chrono::steady_clock::now() - start_tm),
+               total.count, total.value);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fmt::print("Usage: {} input_file\n", argv[0]);
+    if (argc < 2 || argc > 4) {
+        fmt::print("Usage: {} input_file [nodes|subgraph|batched|sink] [backups]\n", argv[0]);
+        return 1;
     }
+    // nodes: one action per node; subgraph: one action per event; batched: one per batch;
+    // sink: one per batch, with the results reduced on each locality
+    const std::string_view mode = argc >= 3 ? argv[2] : "nodes";
+    // Speculative copies of straggling nodes, in nodes mode
+    if (argc == 4 && std::string_view{argv[3]} == "backups") {
+        scheduler.enable_backups();
+    }
+    sch::RemoteBatcher<run_batch, decltype(scheduler)::packed_inputs_t<EvtCtx>,
+                       decltype(scheduler)::results_t<EvtCtx, decltype("Add Squares"_s)>>
+          batcher{n_evts_per_batch, batch_flush_timeout};
     std::ifstream in{argv[1]};
     std::deque<EvtCtx> evts{};
     std::deque<hpx::shared_future<long long>> outputs{};
     std::vector localities = hpx::find_all_localities();
     fmt::print("We have {} localities\n{}\n\n", localities.size(), localities);
+    if (mode == "sink") {
+        return run_sink(in, localities);
+    }
     long long n_evts = 0;
     std::chrono::duration<double, std::milli> total_time = 0ms;
     int counter = 0;
@@ -92,7 +190,16 @@ int main(int argc, char* argv[]) {
             EvtCtx& ec = evts.emplace_back();
             ec = ec_template;
             auto& final_ans = scheduler.retrieve(ec, "Add Squares"_s);
-            bool success = scheduler.schedule(ec, loc);
+            bool success = false;
+            if (mode == "subgraph") {
+                success = scheduler.schedule_subgraph<run_event>(ec, loc, "Add Squares"_s);
+            }
+            else if (mode == "batched") {
+                success = scheduler.schedule_batched(batcher, ec, loc, "Add Squares"_s);
+            }
+            else {
+                success = scheduler.schedule(ec, loc);
+            }
             outputs.push_back(*final_ans);
             n_evts++;
         }
@@ -101,6 +208,7 @@ int main(int argc, char* argv[]) {
         total_time += this_time;
         fmt::print("Took {} to schedule {} events\n", this_time, n_evts_per_block);
     }
+    batcher.flush_all();
     fmt::print("Waiting for all events\n");
     auto start_tm = std::chrono::steady_clock::now();
     hpx::wait_all(outputs.begin(), outputs.end());
@@ -116,5 +224,6 @@ int main(int argc, char* argv[]) {
     fmt::print("Took {} reading out futures\n",
                std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
                      std::chrono::steady_clock::now() - start_tm));
+    fmt::print("Started {} backup copies of straggling nodes\n", scheduler.backups());
     return 0;
 }
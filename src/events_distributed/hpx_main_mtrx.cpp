@@ -0,0 +1,176 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+
+#include "EvtColumns.h"
+#include "EvtPool.h"
+#include "HPXSched.h"
+#include <fmt/chrono.h>
+#include <fmt/ostream.h>
+#include <fmt/ranges.h>
+#include <fmt/format.h>
+#include <hpx/hpx.hpp>
+#include <hpx/serialization/shared_ptr.hpp>
+#include <hpx/wrap_main.hpp>
+
+// Same graph as HPXDemo, with the matrices moving between localities
+#include "CPUMtrx.h"
+using Mtrx = CPUMtrx<1000>;
+using MtrxPtr = std::shared_ptr<Mtrx>;
+constexpr int n_evts_per_block = 3000;
+constexpr int n_evts_in_flight = 30;
+using namespace std::chrono_literals;
+
+template <> struct fmt::formatter<hpx::id_type> : ostream_formatter {};
+
+MtrxPtr make_mtrx_fn(long long x) { return std::make_shared<Mtrx>(x); }
+HPX_PLAIN_ACTION(make_mtrx_fn, make_mtrx);
+
+long long plus_fn(MtrxPtr x, MtrxPtr y) {
+    float ans = (*x + *y).norm();
+    return ans;
+}
+HPX_PLAIN_ACTION(plus_fn, plus);
+
+long long times_fn(MtrxPtr x, MtrxPtr y) {
+    float ans = (*x * *y).norm();
+    return ans;
+}
+HPX_PLAIN_ACTION(times_fn, times);
+
+long long scal_plus_fn(long long x, long long y) { return x + y; }
+HPX_PLAIN_ACTION(scal_plus_fn, scal_plus);
+
+long long square_fn(long long x) { return x * x; }
+HPX_PLAIN_ACTION(square_fn, square);
+
+long long cube_fn(long long x) { return x * x * x; }
+HPX_PLAIN_ACTION(cube_fn, cube);
+
+sch::Sched scheduler{
+      sch::Define("Matrix X"_s, hana::make_tuple("X"_in), make_mtrx{}),
+      sch::Define("Matrix Y"_s, hana::make_tuple("Y"_in), make_mtrx{}),
+      sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube{}),
+      sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube{}),
+      sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus{}),
+      sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times{}),
+      sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square{}),
+      sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square{}),
+      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s),
+                  scal_plus{})};
+struct EvtCtx : public decltype(scheduler)::ECBase {
+    long long X = 5;
+    long long Y = 10;
+};
+BOOST_HANA_ADAPT_STRUCT(EvtCtx, X, Y);
+
+auto run_event_fn(decltype(scheduler)::packed_inputs_t<EvtCtx> inputs) {
+    return scheduler.run_here<EvtCtx>(inputs, "Add Squares"_s);
+}
+HPX_PLAIN_ACTION(run_event_fn, run_event);
+
+// The same graph with the matrices left where they were made: nodes get handles to them and run
+// where most of their matrices are, and only the norms travel
+SCH_REGISTER_RESIDENT(MtrxPtr, resident_mtrx);
+
+hpx::id_type make_resident_mtrx_fn(long long x) {
+    return sch::keep_here(std::make_shared<Mtrx>(x));
+}
+HPX_PLAIN_ACTION(make_resident_mtrx_fn, make_resident_mtrx);
+
+long long resident_plus_fn(hpx::id_type x, hpx::id_type y) {
+    float ans = (*sch::fetch<MtrxPtr>(x) + *sch::fetch<MtrxPtr>(y)).norm();
+    return ans;
+}
+HPX_PLAIN_ACTION(resident_plus_fn, resident_plus);
+
+long long resident_times_fn(hpx::id_type x, hpx::id_type y) {
+    float ans = (*sch::fetch<MtrxPtr>(x) * *sch::fetch<MtrxPtr>(y)).norm();
+    return ans;
+}
+HPX_PLAIN_ACTION(resident_times_fn, resident_times);
+
+sch::Sched resident_scheduler{
+      sch::Define("Matrix X"_s, hana::make_tuple("X"_in), make_resident_mtrx{}),
+      sch::Define("Matrix Y"_s, hana::make_tuple("Y"_in), make_resident_mtrx{}),
+      sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube{}),
+      sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube{}),
+      sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), resident_plus{}),
+      sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), resident_times{}),
+      sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square{}),
+      sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square{}),
+      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s),
+                  scal_plus{})};
+struct ResidentEvtCtx : public decltype(resident_scheduler)::ECBase {
+    long long X = 5;
+    long long Y = 10;
+};
+BOOST_HANA_ADAPT_STRUCT(ResidentEvtCtx, X, Y);
+
+// Reads the events of path and calls schedule_event(ec, locality) for each, which must schedule
+// "Add Squares"; localities take turns
+template <class EC, class ScheduleEvent>
+void run_events(const char* path, ScheduleEvent schedule_event) {
+    sch::io::EventReader<EC> reader{path};
+    sch::EvtPool<EC> evts{n_evts_in_flight};
+    volatile long long o = 0;
+    // Dropping the futures of an event frees the matrices they hold
+    auto consume = [&o](EC& ec) { o = ec.slot["Add Squares"_s]->get(); };
+    std::vector localities = hpx::find_all_localities();
+    fmt::print("We have {} localities\n{}\n\n", localities.size(), localities);
+    long long n_evts = 0;
+    std::chrono::duration<double, std::milli> total_time = 0ms;
+    int counter = 0;
+    while (true) {
+        EC ec_template{};
+        if (!reader.next(ec_template)) {
+            break;
+        }
+        auto start_tm = std::chrono::steady_clock::now();
+        for (int i = 0; i < n_evts_per_block; ++i) {
+            auto loc = localities[counter++ % localities.size()];
+            EC& ec = evts.acquire(consume);
+            sch::assign_inputs(ec, ec_template);
+            bool success = schedule_event(ec, loc);
+            n_evts++;
+        }
+        auto this_time = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
+              std::chrono::steady_clock::now() - start_tm);
+        total_time += this_time;
+        fmt::print("Took {} to schedule {} events\n", this_time, n_evts_per_block);
+    }
+    fmt::print("Waiting for all events\n");
+    auto start_tm = std::chrono::steady_clock::now();
+    evts.consume_all(consume);
+    auto extra_tm = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
+          std::chrono::steady_clock::now() - start_tm);
+    fmt::print("Took {} ({} average) extra waiting for all events\n", extra_tm, extra_tm / n_evts);
+    fmt::print("Took {} total ({} average) scheduling events\n", total_time, total_time / n_evts);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2 && argc != 3) {
+        fmt::print("Usage: {} input_file [nodes|subgraph|resident]\n", argv[0]);
+        return 1;
+    }
+    // nodes: matrices are serialized whenever consecutive nodes run on different localities;
+    // subgraph: only the inputs and the final answer travel; resident: matrices stay where they
+    // were made and the nodes using them follow
+    const std::string_view mode = argc == 3 ? argv[2] : "nodes";
+    if (mode == "resident") {
+        run_events<ResidentEvtCtx>(argv[1], [](ResidentEvtCtx& ec, hpx::id_type loc) {
+            resident_scheduler.retrieve(ec, "Add Squares"_s);
+            return resident_scheduler.schedule(ec, loc, sch::Placement::follow_data);
+        });
+        return 0;
+    }
+    run_events<EvtCtx>(argv[1], [mode](EvtCtx& ec, hpx::id_type loc) {
+        scheduler.retrieve(ec, "Add Squares"_s);
+        return mode == "subgraph" ? scheduler.schedule_subgraph<run_event>(ec, loc, "Add Squares"_s)
+                                  : scheduler.schedule(ec, loc);
+    });
+    return 0;
+}
@@ -6,6 +6,11 @@
 #include <mkl_vsl.h>
 #include <cstdlib>
 #include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ReducedPrecision.h"
 
 void setup() {
     // no-op
@@ -15,53 +20,107 @@ void teardown() {
     // no-op
 }
 
-template <int Rows> class CPUMtrx {
+// Storage is float, or lowp::bf16 / lowp::fp16 to halve the bytes per matrix. The 16-bit
+// variants compute in fp32: GEMM through MKL's mixed-precision gemm (16-bit inputs, fp32
+// accumulation and output), then a rounding pass back to 16 bits.
+template <int Rows, class Storage = float> class CPUMtrx {
   private:
-    float* devPtr = nullptr;
+    Storage* devPtr = nullptr;
+    static constexpr bool is_float = std::is_same_v<Storage, float>;
+
+    // fp32 staging buffer for the 16-bit variants, one per thread
+    static float* scratch() {
+        static thread_local std::vector<float> buffer(Size);
+        return buffer.data();
+    }
 
   public:
     static constexpr int Size = Rows * Rows;
 
     CPUMtrx() {
-        devPtr = (float*)malloc(Size * sizeof(float));
-        memset(devPtr, 0, Size * sizeof(float));
+        devPtr = (Storage*)malloc(Size * sizeof(Storage));
+        memset(devPtr, 0, Size * sizeof(Storage));
     }
     CPUMtrx(const CPUMtrx&) = delete;
-    CPUMtrx(CPUMtrx&&) = default;
+    // Moving hands over the buffer, so the moved-from matrix does not free it
+    CPUMtrx(CPUMtrx&& other) noexcept : devPtr(std::exchange(other.devPtr, nullptr)) {}
+    CPUMtrx& operator=(CPUMtrx&& other) noexcept {
+        std::swap(devPtr, other.devPtr);
+        return *this;
+    }
     CPUMtrx(long long mult) {
         static thread_local VSLStreamStatePtr stream = nullptr;
         if (!stream) {
             vslNewStream(&stream, VSL_BRNG_MT19937, 777);
         }
         float mult_f = mult;
-        devPtr = (float*)malloc(Size * sizeof(float));
-        vsRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, Size, devPtr, 1e-7f, 1.f);
-        cblas_sscal(Size, mult_f, devPtr, 1);
+        devPtr = (Storage*)malloc(Size * sizeof(Storage));
+        float* values = nullptr;
+        if constexpr (is_float) {
+            values = devPtr;
+        }
+        else {
+            values = scratch();
+        }
+        vsRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, Size, values, 1e-7f, 1.f);
+        cblas_sscal(Size, mult_f, values, 1);
+        if constexpr (!is_float) {
+            lowp::from_float(values, devPtr, Size);
+        }
     }
     ~CPUMtrx() { free((void*)devPtr); }
 
+    // Memory owned by this matrix, for the scheduler's accounting
+    std::size_t bytes() const { return sizeof(*this) + (devPtr ? Size * sizeof(Storage) : 0); }
+
     CPUMtrx operator*(const CPUMtrx& rhs) {
         CPUMtrx result{};
         const float alpha = 1;
         const float beta = 0;
-        cblas_sgemm(CBLAS_LAYOUT::CblasColMajor, CBLAS_TRANSPOSE::CblasNoTrans,
-                    CBLAS_TRANSPOSE::CblasNoTrans, Rows, Rows, Rows, alpha, this->devPtr, Rows,
-                    rhs.devPtr, Rows, beta, result.devPtr, Rows);
+        if constexpr (is_float) {
+            cblas_sgemm(CBLAS_LAYOUT::CblasColMajor, CBLAS_TRANSPOSE::CblasNoTrans,
+                        CBLAS_TRANSPOSE::CblasNoTrans, Rows, Rows, Rows, alpha, this->devPtr, Rows,
+                        rhs.devPtr, Rows, beta, result.devPtr, Rows);
+        }
+        else {
+            float* product = scratch();
+            if constexpr (std::is_same_v<Storage, lowp::bf16>) {
+                cblas_gemm_bf16bf16f32(CBLAS_LAYOUT::CblasColMajor, CBLAS_TRANSPOSE::CblasNoTrans,
+                                       CBLAS_TRANSPOSE::CblasNoTrans, Rows, Rows, Rows, alpha,
+                                       (const MKL_BF16*)this->devPtr, Rows,
+                                       (const MKL_BF16*)rhs.devPtr, Rows, beta, product, Rows);
+            }
+            else {
+                cblas_gemm_f16f16f32(CBLAS_LAYOUT::CblasColMajor, CBLAS_TRANSPOSE::CblasNoTrans,
+                                     CBLAS_TRANSPOSE::CblasNoTrans, Rows, Rows, Rows, alpha,
+                                     (const MKL_F16*)this->devPtr, Rows, (const MKL_F16*)rhs.devPtr,
+                                     Rows, beta, product, Rows);
+            }
+            lowp::from_float(product, result.devPtr, Size);
+        }
         return result;
     }
 
     CPUMtrx operator+(const CPUMtrx& rhs) {
         CPUMtrx result{};
-        const float alpha = 1;
-        cblas_scopy(Size, this->devPtr, 1, result.devPtr, 1);
-        cblas_saxpy(Size, alpha, rhs.devPtr, 1, result.devPtr, 1);
+        if constexpr (is_float) {
+            const float alpha = 1;
+            cblas_scopy(Size, this->devPtr, 1, result.devPtr, 1);
+            cblas_saxpy(Size, alpha, rhs.devPtr, 1, result.devPtr, 1);
+        }
+        else {
+            lowp::add(this->devPtr, rhs.devPtr, result.devPtr, Size);
+        }
         return result;
     }
 
     float norm() {
-        float result = 0.f;
-        result = cblas_snrm2(Size, this->devPtr, 1);
-        return result;
+        if constexpr (is_float) {
+            return cblas_snrm2(Size, this->devPtr, 1);
+        }
+        else {
+            return lowp::norm(this->devPtr, Size);
+        }
     }
 };
 
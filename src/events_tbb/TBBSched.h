@@ -1,8 +1,13 @@
 // -*-c++-*-
 #ifndef HPXSCHED_H
 #define HPXSCHED_H
+#include <array>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <tuple>
 #include <type_traits>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -21,12 +26,17 @@ using namespace hana::literals;
 #include <tbb/tbb.h>
 namespace flow = oneapi::tbb::flow;
 
+#include "Filter.h"
+#include "NodeOpts.h"
+#include "Outputs.h"
+
 namespace sch {
 class input_tag {};
 template <class HS> struct Input {
     using hana_tag = sch::input_tag;
     HS name;
 
+    constexpr Input() = default;
     constexpr Input(HS name) : name(name) {}
 };
 } // namespace sch
@@ -36,31 +46,183 @@ template <> struct hana::hash_impl<sch::input_tag, hana::when<true>> {
 };
 
 namespace sch {
-template <class Key, class Inputs, class Func> auto Define(Key key, Inputs inputs, Func func) {
+template <class Key, class Inputs, class Func, class... Opts>
+auto Define(Key key, Inputs inputs, Func func, Opts... opts) {
     static_assert(hana::is_a<hana::string_tag>(key), "Define's key must be a hana::string");
     static_assert(hana::Sequence<Inputs>::value, "Define's inputs must be a tuple");
-    // Tuple items are: key, inputs tuple, function to calculate, bool (is final)
-    return hana::make_pair(key, hana::make_tuple(key, inputs, std::function{func}, false));
+    // Tuple items are: key, inputs tuple, function to calculate, bool (is final), node options
+    return hana::make_pair(key, hana::make_tuple(key, inputs, std::function{func}, false,
+                                                 make_node_opts(opts...)));
+}
+
+// Nodes over a collection. The function of a map node takes one element of its first input, a
+// collection_t, and the other inputs whole; the node's value is the collection of the results. A
+// reduce node combines the results instead, starting every chunk from init, which must be an
+// identity of combine. Collections of up to a chunk (see chunk_size) are done in the node's
+// task, longer ones in chunks by tbb::parallel_for or tbb::parallel_reduce.
+// Flow graph messages are copied to every successor and cannot be references, so collections go
+// between nodes as shared pointers: nodes feeding a map or reduce node return a collection_t.
+template <class T> using collection_t = std::shared_ptr<const std::vector<T>>;
+
+template <class Func, class Args = ct::args_t<Func>> struct MapFn;
+template <class Func, class T, class... Args> struct MapFn<Func, std::tuple<T, Args...>> {
+    using Elem = std::decay_t<T>;
+    using U = ct::return_type_t<Func>;
+    static_assert(!std::is_same_v<U, bool>, "std::vector<bool> cannot be written in parallel");
+    Func func;
+    std::size_t grain;
+
+    collection_t<U> operator()(collection_t<Elem> xs, Args... args) const {
+        auto result = std::make_shared<std::vector<U>>(xs->size());
+        auto part = [&](const tbb::blocked_range<std::size_t>& r) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i) {
+                (*result)[i] = func((*xs)[i], args...);
+            }
+        };
+        const auto n_threads = tbb::this_task_arena::max_concurrency();
+        const std::size_t chunk = chunk_size(xs->size(), grain, n_threads);
+        if (xs->size() <= chunk) {
+            part({0, xs->size()});
+        }
+        else {
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, xs->size(), chunk), part,
+                              tbb::simple_partitioner{});
+        }
+        return result;
+    }
+};
+template <class Func, class Combine, class R, class Args = ct::args_t<Func>> struct ReduceFn;
+template <class Func, class Combine, class R, class T, class... Args>
+struct ReduceFn<Func, Combine, R, std::tuple<T, Args...>> {
+    using Elem = std::decay_t<T>;
+    Func func;
+    Combine combine;
+    R init;
+    std::size_t grain;
+
+    R operator()(collection_t<Elem> xs, Args... args) const {
+        auto part = [&](const tbb::blocked_range<std::size_t>& r, R acc) {
+            for (std::size_t i = r.begin(); i != r.end(); ++i) {
+                acc = combine(acc, func((*xs)[i], args...));
+            }
+            return acc;
+        };
+        const auto n_threads = tbb::this_task_arena::max_concurrency();
+        const std::size_t chunk = chunk_size(xs->size(), grain, n_threads);
+        if (xs->size() <= chunk) {
+            return part({0, xs->size()}, init);
+        }
+        return tbb::parallel_reduce(tbb::blocked_range<std::size_t>(0, xs->size(), chunk), init,
+                                    part, combine, tbb::simple_partitioner{});
+    }
+};
+
+template <class Key, class Inputs, class Func, class... Opts>
+auto DefineMap(Key key, Inputs inputs, Func func, Opts... opts) {
+    return Define(key, inputs, MapFn<Func>{func, make_node_opts(opts...).grain}, opts...);
 }
 
+template <class Key, class Inputs, class Func, class Combine, class R, class... Opts>
+auto DefineReduce(Key key, Inputs inputs, Func func, Combine combine, R init, Opts... opts) {
+    return Define(key, inputs,
+                  ReduceFn<Func, Combine, R>{func, combine, init, make_node_opts(opts...).grain},
+                  opts...);
+}
+
+// Which nodes are gated by a filter (see Filter.h), worked out from the map of definitions. The
+// slot types depend on it, so it is needed before Sched is complete.
+template <class Map, class Key> using def_t = std::decay_t<decltype(std::declval<Map&>()[Key{}])>;
+template <class Map, class Key>
+using fn_value_t = ct::return_type_t<decltype(hana::at_c<2>(std::declval<def_t<Map, Key>&>()))>;
+template <class Map, class Key> constexpr bool gated();
+template <class Map, class Key> constexpr bool may_be_empty() {
+    if constexpr (hana::is_a<sch::input_tag, Key>()) {
+        return false;
+    }
+    else {
+        return is_optional_v<fn_value_t<Map, Key>> || gated<Map, Key>();
+    }
+}
+template <class Map, class Key> constexpr bool gated() {
+    using inputs_t = std::decay_t<decltype(hana::at_c<1>(std::declval<def_t<Map, Key>&>()))>;
+    return hana::unpack(inputs_t{}, [](auto... in) {
+        return (may_be_empty<Map, source_t<decltype(in)>>() || ...);
+    });
+}
+// Value node Key sends downstream and writes to its slot
+template <class Map, class Key>
+using slot_value_t = std::conditional_t<gated<Map, Key>(), maybe_t<fn_value_t<Map, Key>>,
+                                        fn_value_t<Map, Key>>;
+
 template <class... Defs> class Sched {
   private:
     hana::map<Defs...> definitions;
-    // Given a definition, get a default-constructed prototype of the function return type
-    static constexpr auto get_ret_t = [](auto&& F) {
-        return ct::return_type_t<decltype(hana::at_c<2>(F))>{};
+    // Given a key, get a default-constructed prototype of the value of its node
+    static constexpr auto get_ret_t = [](auto key) {
+        return slot_value_t<hana::map<Defs...>, decltype(key)>{};
     };
     // Given a definition, find out if this key has been retrieved
     static constexpr auto get_key = hana::reverse_partial(hana::at, hana::size_c<0>);
     static constexpr auto get_inputs = hana::reverse_partial(hana::at, hana::size_c<1>);
     static constexpr auto get_fn = hana::reverse_partial(hana::at, hana::size_c<2>);
     static constexpr auto is_final = hana::reverse_partial(hana::at, hana::size_c<3>);
+    static constexpr auto get_opts = hana::reverse_partial(hana::at, hana::size_c<4>);
 
   public:
     using Keys = decltype(hana::keys(definitions));
-    using ResultTypes = decltype(hana::transform(hana::values(definitions), get_ret_t));
+    using ResultTypes = decltype(hana::transform(Keys{}, get_ret_t));
 
   private:
+    static constexpr std::size_t n_nodes = hana::length(Keys{});
+
+    template <class Key> static constexpr std::size_t index_of() {
+        using index_t = decltype(hana::index_if(Keys{}, hana::equal.to(Key{})).value());
+        return std::decay_t<index_t>::value;
+    }
+
+    template <class Key> static constexpr bool is_gated() {
+        return gated<hana::map<Defs...>, Key>();
+    }
+    template <class Key> using value_t = slot_value_t<hana::map<Defs...>, Key>;
+    template <class Key> using item_t = def_t<hana::map<Defs...>, Key>;
+
+    // Values a node receives: the arguments of its function, except that the inputs that can
+    // be empty send a std::optional and outputs of multi-output nodes the whole tuple
+    template <class In, class Arg> static auto port_of() {
+        if constexpr (is_output_v<In> || may_be_empty<hana::map<Defs...>, source_t<In>>()) {
+            return hana::type_c<value_t<source_t<In>>>;
+        }
+        else {
+            return hana::type_c<Arg>;
+        }
+    }
+    template <class Key, std::size_t... I> static auto ports_of(std::index_sequence<I...>) {
+        using inputs_t = std::decay_t<decltype(get_inputs(std::declval<item_t<Key>&>()))>;
+        using args_t = ct::args_t<std::decay_t<decltype(get_fn(std::declval<item_t<Key>&>()))>>;
+        return hana::type_c<std::tuple<typename decltype(port_of<
+              std::decay_t<decltype(hana::at_c<I>(inputs_t{}))>,
+              std::tuple_element_t<I, args_t>>())::type...>>;
+    }
+    template <class Key>
+    using ports_t = typename decltype(ports_of<Key>(std::make_index_sequence<hana::length(
+          std::decay_t<decltype(get_inputs(std::declval<item_t<Key>&>()))>{})>{}))::type;
+
+    // Which nodes are on the critical path to the nodes retrieved so far
+    std::array<bool, n_nodes> critical_path() {
+        GraphShape<n_nodes> shape{};
+        hana::for_each(hana::values(definitions), [&](auto&& v) {
+            constexpr std::size_t k = index_of<std::decay_t<decltype(get_key(v))>>();
+            shape.required[k] = is_final(v);
+            shape.costs[k] = get_opts(v).cost;
+            hana::for_each(get_inputs(v), [&](auto in) {
+                if constexpr (!hana::is_a<sch::input_tag>(in)) {
+                    shape.inputs[k].push_back(index_of<source_t<decltype(in)>>());
+                }
+            });
+        });
+        return critical_nodes(shape);
+    }
+
     // Given a key and an event context, get the node
     template <bool Assign = false, class EC, class Key>
     static decltype(auto) get_node(EC& ec, const Key& k) {
@@ -74,16 +236,16 @@ template <class... Defs> class Sched {
         }
         else {
             // Need to figure out the correct type for this node
-            if constexpr (hana::is_a<sch::input_tag, decltype(k)>()) {
+            if constexpr (is_output_v<Key>) {
+                return get_node(ec, source_t<Key>{});
+            }
+            else if constexpr (hana::is_a<sch::input_tag, decltype(k)>()) {
                 using in_t = std::remove_reference_t<decltype(hana::at_key(ec, k.name))>;
                 using node_t = flow::continue_node<in_t>;
                 return dynamic_cast<node_t*>(ec.node_slot[k.name]);
             }
             else {
-                using func_t = decltype(get_fn(definitions[k]));
-                using args_t = ct::args_t<func_t>;
-                using ret_t = ct::return_type_t<func_t>;
-                using node_t = flow::composite_node<args_t, std::tuple<ret_t>>;
+                using node_t = flow::composite_node<ports_t<Key>, std::tuple<value_t<Key>>>;
                 return dynamic_cast<node_t*>(ec.node_slot[k]);
             }
         }
@@ -102,14 +264,16 @@ template <class... Defs> class Sched {
         hana::for_each(input_keys, make_input_node);
     }
     // Makes internal nodes
-    template <class EC, class Val> static void make_node(EC& ec, const Val& v) {
+    // Critical nodes get a task priority, so TBB runs them before the other ready nodes
+    template <class EC, class Val> static void make_node(EC& ec, const Val& v, bool critical) {
         using func_t = decltype(get_fn(v));
-        using args_t = ct::args_t<func_t>;
+        using args_t = ports_t<std::decay_t<decltype(get_key(v))>>;
         using ret_t = ct::return_type_t<func_t>;
 
         auto& input = ec.add_node(new flow::join_node<args_t, flow::queueing>(*ec.graph));
-        auto& fn = ec.add_node(
-              new flow::function_node<args_t, ret_t>(*ec.graph, 1, hana::fuse(get_fn(v))));
+        auto& fn = ec.add_node(new flow::function_node<args_t, ret_t>(
+              *ec.graph, 1, hana::fuse(pick_inputs(get_inputs(v), get_fn(v))),
+              critical ? flow::node_priority_t{1} : flow::no_priority));
         flow::make_edge(input, fn);
 
         if (is_final(v)) {
@@ -130,6 +294,56 @@ template <class... Defs> class Sched {
         get_node<true>(ec, get_key(v)) = &composite;
     }
 
+    // A gated node checks its inputs in a lightweight node, which runs in the thread that sent
+    // the last one instead of as a task. If any is empty, it sends an empty value straight on;
+    // otherwise the function runs in a node of its own, as in make_node.
+    template <class EC, class Val>
+    static void make_gated_node(EC& ec, const Val& v, bool critical) {
+        using Key = std::decay_t<decltype(get_key(v))>;
+        using in_t = ports_t<Key>;
+        using out_t = value_t<Key>;
+        using gate_t = flow::multifunction_node<in_t, std::tuple<in_t, out_t>, flow::lightweight>;
+
+        auto& input = ec.add_node(new flow::join_node<in_t, flow::queueing>(*ec.graph));
+        auto& gate = ec.add_node(new gate_t(
+              *ec.graph, flow::unlimited,
+              [](const in_t& in, typename gate_t::output_ports_type& ports) {
+                  if (std::apply([](const auto&... x) { return (present(x) && ...); }, in)) {
+                      std::get<0>(ports).try_put(in);
+                  }
+                  else {
+                      std::get<1>(ports).try_put(out_t{});
+                  }
+              }));
+        auto& fn = ec.add_node(new flow::function_node<in_t, out_t>(
+              *ec.graph, 1,
+              [f = pick_inputs(get_inputs(v), get_fn(v))](const in_t& in) {
+                  auto call = [&f](const auto&... x) -> out_t { return f(unwrap(x)...); };
+                  return std::apply(call, in);
+              },
+              critical ? flow::node_priority_t{1} : flow::no_priority));
+        auto& output = ec.add_node(new flow::broadcast_node<out_t>(*ec.graph));
+        flow::make_edge(input, gate);
+        flow::make_edge(flow::output_port<0>(gate), fn);
+        flow::make_edge(fn, output);
+        flow::make_edge(flow::output_port<1>(gate), output);
+
+        if (is_final(v)) {
+            auto& write_fn = ec.add_node(
+                  new flow::function_node<out_t, bool>(*ec.graph, 1, [&v, &ec](const out_t& value) {
+                      ec.slot[get_key(v)] = value;
+                      return true;
+                  }));
+            flow::make_edge(output, write_fn);
+        }
+
+        auto& composite = ec.add_node(
+              new flow::composite_node<in_t, std::tuple<out_t>>(*ec.graph));
+        composite.set_external_ports(std::apply(BOOST_HOF_LIFT(std::tie), input.input_ports()),
+                                     std::tie(output));
+        get_node<true>(ec, get_key(v)) = &composite;
+    }
+
     template <class HanaTuple, class TBBNode, std::size_t... I>
     static void make_edges_impl(HanaTuple&& sources, TBBNode&& target, std::index_sequence<I...>) {
         (flow::make_edge(*hana::at_c<I>(sources), flow::input_port<I>(target)), ...);
@@ -155,8 +369,7 @@ template <class... Defs> class Sched {
                                                                 // them at end
                                                                 //
         ECBase& operator=(const ECBase&) {
-            start_node.reset(new flow::continue_node<flow::continue_msg>(
-                  *graph, 1, [](const flow::continue_msg&) { return flow::continue_msg(); }));
+            // The graph belongs to this context; assigning another context's inputs keeps it
             return *this;
         }
 
@@ -171,9 +384,14 @@ template <class... Defs> class Sched {
             if (done) return;
             graph->wait_for_all();
             done = true;
-            delete graph.release();
-            nodes.clear();
-            delete start_node.release();
+        }
+
+        // Prepares the context for the next event. The graph, its nodes and node_slot are kept:
+        // the nodes read the inputs through references to this context, so they are built once
+        // and fired again for every event.
+        void reset() {
+            wait();
+            done = false;
         }
     };
 
@@ -184,14 +402,35 @@ template <class... Defs> class Sched {
         return ec.slot[key]; // Return reference to slot
     }
 
+    // Replaces the cost of a node, e.g. with a measured run time. Only graphs built afterwards
+    // (contexts that have not been scheduled yet) see the change.
+    template <class Key> void set_cost(Key key, double cost) {
+        get_opts(definitions[key]).cost = cost;
+    }
+
     // This function does the scheduling (and running)
     // This time, use TBB flow graphs
     template <class EC> bool schedule(EC& ec) {
-        make_input_nodes(ec);
-        auto this_make_node = [&ec](auto&& v) { return make_node(ec, v); };
-        auto this_make_connections = [&ec](auto&& v) { return make_connections(ec, v); };
-        hana::for_each(hana::values(definitions), this_make_node);
-        hana::for_each(hana::values(definitions), this_make_connections);
+        if (!ec.start_node) {
+            // First event in this context: build its graph. The priorities are fixed with it,
+            // so retrieve every output before the first schedule().
+            ec.start_node.reset(new flow::continue_node<flow::continue_msg>(
+                  *ec.graph, 1, [](const flow::continue_msg&) { return flow::continue_msg(); }));
+            make_input_nodes(ec);
+            auto critical = critical_path();
+            auto this_make_node = [&ec, &critical](auto&& v) {
+                using Key = std::decay_t<decltype(get_key(v))>;
+                if constexpr (is_gated<Key>()) {
+                    return make_gated_node(ec, v, critical[index_of<Key>()]);
+                }
+                else {
+                    return make_node(ec, v, critical[index_of<Key>()]);
+                }
+            };
+            auto this_make_connections = [&ec](auto&& v) { return make_connections(ec, v); };
+            hana::for_each(hana::values(definitions), this_make_node);
+            hana::for_each(hana::values(definitions), this_make_connections);
+        }
         ec.start_node->try_put(flow::continue_msg());
         return true;
     }
@@ -1,15 +1,24 @@
 #include <chrono>
-#include <deque>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <thread>
 
+#include "EvtColumns.h"
+#include "EvtPool.h"
 #include "TBBSched.h"
 #include <fmt/chrono.h>
 #include <fmt/format.h>
 
+#ifdef EIGEN_MTRX_ROWS
+// Small matrices with inline storage instead of MKL
+#include "EigenMtrx.h"
+using Mtrx = EigenMtrx<EIGEN_MTRX_ROWS>;
+#else
 #include "CPUMtrx.h"
 using Mtrx = CPUMtrx<1000>;
+#endif
 constexpr int n_evts_per_block = 3000;
 constexpr int n_evts_in_flight = 32;
 using namespace std::chrono_literals;
@@ -21,6 +30,16 @@ template <class R, class P> void busy_wait(std::chrono::duration<R, P> time) {
     }
 }
 
+// Events with an input below this are rejected before their matrices are made
+long long min_input = std::numeric_limits<long long>::min();
+
+std::optional<long long> select_input(long long x) {
+    if (x < min_input) {
+        return std::nullopt;
+    }
+    return x;
+}
+
 std::shared_ptr<Mtrx> make_mtrx(long long x) {
     auto mtrx = std::make_shared<Mtrx>(x);
     return mtrx;
@@ -52,62 +71,70 @@ long long cube(long long x) {
     return x * x * x;
 }
 
-sch::Sched scheduler{
-      sch::Define("Matrix X"_s, hana::make_tuple("X"_in), make_mtrx),
-      sch::Define("Matrix Y"_s, hana::make_tuple("Y"_in), make_mtrx),
-      sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube),
-      sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube),
-      sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus),
-      sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times),
-      sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square),
-      sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square),
-      sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s), scal_plus)};
-struct EvtCtx : public decltype(scheduler)::ECBase {
+// The benchmark graph, making its matrices from x and y
+template <class X, class Y> auto demo_nodes(X x, Y y) {
+    return hana::make_tuple(
+          sch::Define("Matrix X"_s, hana::make_tuple(x), make_mtrx),
+          sch::Define("Matrix Y"_s, hana::make_tuple(y), make_mtrx),
+          sch::Define("Cube Plus"_s, hana::make_tuple("Y plus X"_s), cube),
+          sch::Define("Cube Times"_s, hana::make_tuple("Y times X"_s), cube),
+          sch::Define("Y plus X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), plus),
+          // The product is ~N times the work of the other nodes, so its branch is the critical
+          // path
+          sch::Define("Y times X"_s, hana::make_tuple("Matrix X"_s, "Matrix Y"_s), times,
+                      sch::cost(1000)),
+          sch::Define("Square Plus"_s, hana::make_tuple("Y plus X"_s), square),
+          sch::Define("Square Times"_s, hana::make_tuple("Y times X"_s), square),
+          sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s),
+                      scal_plus));
+}
+auto make_sched = [](auto... defs) { return sch::Sched{defs...}; };
+
+sch::Sched scheduler = hana::unpack(demo_nodes("X"_in, "Y"_in), make_sched);
+// With a min_input, a pair of filters selects the events first: every other node is gated by
+// them, and skipped for rejected events. A graph of its own, so the default one is not gated.
+sch::Sched selecting_scheduler = hana::unpack(
+      hana::concat(hana::make_tuple(
+                         sch::Define("Selected X"_s, hana::make_tuple("X"_in), select_input),
+                         sch::Define("Selected Y"_s, hana::make_tuple("Y"_in), select_input)),
+                   demo_nodes("Selected X"_s, "Selected Y"_s)),
+      make_sched);
+
+template <class S> struct EvtCtx : public S::ECBase {
     BOOST_HANA_DEFINE_STRUCT(EvtCtx, (long long, X), (long long, Y));
-    decltype(hana::to_map(
-          hana::transform(hana::insert_range(decltype(scheduler)::Keys{}, hana::size_c<0>,
-                                             hana::make_tuple("X"_s, "Y"_s)),
-                          make_key_ptr_pair))) node_slot{};
+    decltype(hana::to_map(hana::transform(hana::insert_range(typename S::Keys{}, hana::size_c<0>,
+                                                             hana::make_tuple("X"_s, "Y"_s)),
+                                          S::ECBase::make_key_ptr_pair))) node_slot{};
 };
 
-int main(int argc, char* argv[]) {
-    auto limit_n_threads = tbb::global_control(tbb::global_control::max_allowed_parallelism,
-                                               std::atoi(argv[2]));
-    if (argc != 3) {
-        fmt::print("Usage: {} input_file num_threads\n", argv[0]);
-        return 1;
-    }
-    std::ifstream in{argv[1]};
-    std::deque<EvtCtx> evts{};
-    std::deque<EvtCtx*> cleanup_temp{};
-    std::deque<std::reference_wrapper<long long>> outputs{};
+template <class S> void run(S& scheduler, const char* input_file) {
+    sch::io::EventReader<EvtCtx<S>> reader{input_file};
+    sch::EvtPool<EvtCtx<S>> evts{n_evts_in_flight};
+    volatile long long o = 0;
+    long long n_selected = 0;
+    // Called for the oldest event when its slot is needed again, and for every event at the end
+    auto consume = [&o, &n_selected](EvtCtx<S>& ec) {
+        ec.wait();
+        if (const auto& ans = ec.slot["Add Squares"_s]; sch::present(ans)) {
+            o = sch::unwrap(ans);
+            n_selected++;
+        }
+    };
 
     long long n_evts = 0;
     std::chrono::duration<float, std::milli> total_time = 0ms;
-    while (in.good()) {
-        EvtCtx ec_template{};
-        in >> ec_template.X >> ec_template.Y;
-        if (!in.good()) {
+    while (true) {
+        EvtCtx<S> ec_template{};
+        if (!reader.next(ec_template)) {
             break;
         }
         auto start_tm = std::chrono::steady_clock::now();
         for (int i = 0; i < n_evts_per_block; ++i) {
-            EvtCtx& ec = evts.emplace_back();
-            ec = ec_template;
+            EvtCtx<S>& ec = evts.acquire(consume);
+            sch::assign_inputs(ec, ec_template);
             auto& final_ans = scheduler.retrieve(ec, "Add Squares"_s);
             bool success = scheduler.schedule(ec);
-            outputs.emplace_back(final_ans);
-            cleanup_temp.push_back(&ec);
             n_evts++;
-            if (n_evts % n_evts_in_flight == n_evts_in_flight - 1) {
-                // auto start_wait = std::chrono::steady_clock::now();
-                tbb::parallel_for_each(cleanup_temp, [](EvtCtx* const& ec) { ec->wait(); });
-                // auto end_wait = std::chrono::steady_clock::now() - start_wait;
-                // fmt::print("This wait took {}\n",
-                //            std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
-                //                  end_wait));
-                cleanup_temp.clear();
-            }
         }
         auto this_time = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
               std::chrono::steady_clock::now() - start_tm);
@@ -116,21 +143,27 @@ int main(int argc, char* argv[]) {
     }
     fmt::print("Waiting for all events\n");
     auto start_tm = std::chrono::steady_clock::now();
-    // hpx::wait_all(outputs.begin(), outputs.end());
-    tbb::parallel_for_each(evts, [](const EvtCtx& ec) { const_cast<EvtCtx&>(ec).wait(); });
+    evts.consume_all(consume);
     auto extra_tm = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
           std::chrono::steady_clock::now() - start_tm);
     fmt::print("Took {} ({} average) extra waiting for all events\n", extra_tm, extra_tm / n_evts);
     fmt::print("Took {} total ({} average) scheduling events\n", total_time, total_time / n_evts);
-    start_tm = std::chrono::steady_clock::now();
-    volatile long long o = 0;
-    for (auto&& out : outputs) {
-        o = out;
+    fmt::print("{} of {} events passed the selection\n", n_selected, n_evts);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 4) {
+        fmt::print("Usage: {} input_file num_threads [min_input]\n", argv[0]);
+        return 1;
+    }
+    auto limit_n_threads = tbb::global_control(tbb::global_control::max_allowed_parallelism,
+                                               std::atoi(argv[2]));
+    if (argc == 4) {
+        min_input = std::atoll(argv[3]);
+        run(selecting_scheduler, argv[1]);
+    }
+    else {
+        run(scheduler, argv[1]);
     }
-    fmt::print("Took {} reading out data\n",
-               std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
-                     std::chrono::steady_clock::now() - start_tm));
-    // wait for all cleanup to be done
-    // hpx::wait_all(cleanups.begin(), cleanups.end());
     return 0;
 }
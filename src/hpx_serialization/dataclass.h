@@ -2,6 +2,7 @@
 
 // also includes hpx/serialization/vector.hpp and hpx/serialization/string.hpp
 #include <hpx/modules/serialization.hpp>
+#include <hpx/serialization/array.hpp>
 /**
  * Segfault when serializing Event to remote nodes:
  * src/tcmalloc.cc:333] Attempt to free invalid pointer
@@ -41,7 +42,11 @@ std::ostream& operator<<(std::ostream&, const Event&);
 
 template <class Archive> void Event::serialize(Archive& ar, const unsigned int version) {
 #ifdef DEFAULT_CONSTRUCTIBLE
-    ar& name& data;
+    // The payload goes through make_array so that large events are sent as zero-copy chunks
+    std::size_t n_elem = data.size();
+    ar& name& n_elem;
+    data.resize(n_elem);
+    ar& hpx::serialization::make_array(data.data(), n_elem);
 #endif
 }
 
@@ -50,14 +55,18 @@ namespace hpx::serialization {
 
 template <class Archive>
 inline void save_construct_data(Archive& ar, Event const* t, const unsigned int file_version) {
-    ar & t->name & t->data;
+    std::size_t n_elem = t->data.size();
+    ar & t->name & n_elem;
+    ar & hpx::serialization::make_array(t->data.data(), n_elem);
 }
 
 template <class Archive>
 inline void load_construct_data(Archive& ar, Event* t, const unsigned int file_version) {
     std::string name;
-    std::vector<int> data;
-    ar & name & data;
+    std::size_t n_elem = 0;
+    ar & name & n_elem;
+    std::vector<int> data(n_elem);
+    ar & hpx::serialization::make_array(data.data(), n_elem);
     ::new (t) Event(name, data);
 }
 
@@ -0,0 +1,130 @@
+// Times the two matrix nodes of the demos, (x * y).norm() and (x + y).norm():
+//   sizes: sweeps small sizes with EigenMtrx and the MKL-backed CPUMtrx, to find where MKL wins
+//   precision: CPUMtrx with bf16 and fp16 storage against float, for accuracy and throughput
+//   autotune: the Autotuner on a made-up throughput curve, to check that it finds its peak
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "Autotuner.h"
+#include "CPUMtrx.h"
+#include "EigenMtrx.h"
+#include <fmt/format.h>
+
+// Average time per call of fn, in microseconds
+template <class Fn> double time_us(int reps, Fn&& fn) {
+    volatile float sink = 0;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; ++i) {
+        sink = fn();
+    }
+    std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start_tm;
+    return took.count() / reps;
+}
+
+struct Row {
+    double eigen_times, mkl_times, eigen_plus, mkl_plus;
+};
+
+template <int Rows> Row bench() {
+    // About the same amount of work for every size
+    const int reps = std::max(1000, 200'000'000 / (2 * Rows * Rows * Rows));
+    EigenMtrx<Rows> ex{5}, ey{10};
+    CPUMtrx<Rows> cx{5}, cy{10};
+    return {time_us(reps, [&] { return (ex * ey).norm(); }),
+            time_us(reps, [&] { return (cx * cy).norm(); }),
+            time_us(reps, [&] { return (ex + ey).norm(); }),
+            time_us(reps, [&] { return (cx + cy).norm(); })};
+}
+
+template <int... Sizes> void sweep(std::integer_sequence<int, Sizes...>) {
+    fmt::print("{:>5} | {:>12} {:>12} | {:>12} {:>12}\n", "Rows", "Eigen x (us)", "MKL x (us)",
+               "Eigen + (us)", "MKL + (us)");
+    int times_crossover = 0;
+    int plus_crossover = 0;
+    auto report = [&](int rows, const Row& row) {
+        fmt::print("{:>5} | {:>12.3f} {:>12.3f} | {:>12.3f} {:>12.3f}\n", rows, row.eigen_times,
+                   row.mkl_times, row.eigen_plus, row.mkl_plus);
+        if (!times_crossover && row.mkl_times < row.eigen_times) {
+            times_crossover = rows;
+        }
+        if (!plus_crossover && row.mkl_plus < row.eigen_plus) {
+            plus_crossover = rows;
+        }
+    };
+    (report(Sizes, bench<Sizes>()), ...);
+    auto describe = [](int rows) {
+        return rows ? fmt::format("from {} rows", rows) : std::string{"not in this range"};
+    };
+    fmt::print("\nMKL wins for products {}, for sums {}\n", describe(times_crossover),
+               describe(plus_crossover));
+}
+
+template <int Rows> void compare_precision() {
+    const int reps = std::max(5, 2'000'000'000 / (2 * Rows * Rows * Rows));
+    CPUMtrx<Rows> fx{5}, fy{10};
+    const float times_ref = (fx * fy).norm();
+    const float plus_ref = (fx + fy).norm();
+    const double float_times_us = time_us(reps, [&] { return (fx * fy).norm(); });
+    const double float_plus_us = time_us(reps, [&] { return (fx + fy).norm(); });
+    auto report = [&](std::string_view name, auto&& x, auto&& y) {
+        const double times_us = time_us(reps, [&] { return (x * y).norm(); });
+        const double plus_us = time_us(reps, [&] { return (x + y).norm(); });
+        fmt::print("{:>5} {:>6} | {:>10.1f} {:>7.2f}x {:>9.2e} | {:>10.1f} {:>7.2f}x {:>9.2e}\n",
+                   Rows, name, times_us, float_times_us / times_us,
+                   std::abs((x * y).norm() - times_ref) / times_ref, plus_us,
+                   float_plus_us / plus_us, std::abs((x + y).norm() - plus_ref) / plus_ref);
+    };
+    report("float", fx, fy);
+    // Same random stream as the float matrices, so only the rounding differs
+    report("bf16", CPUMtrx<Rows, lowp::bf16>{5}, CPUMtrx<Rows, lowp::bf16>{10});
+    report("fp16", CPUMtrx<Rows, lowp::fp16>{5}, CPUMtrx<Rows, lowp::fp16>{10});
+}
+
+template <int... Sizes> void precision(std::integer_sequence<int, Sizes...>) {
+    fmt::print("{:>5} {:>6} | {:>10} {:>8} {:>9} | {:>10} {:>8} {:>9}\n", "Rows", "Type",
+               "x (us)", "speedup", "rel. err", "+ (us)", "speedup", "rel. err");
+    (compare_precision<Sizes>(), ...);
+}
+
+// Tunes one setting starting above the peak of a noisy throughput curve, as with the events in
+// flight of the demos once memory bandwidth is saturated; true if it ends up near the peak
+bool check_autotuner() {
+    constexpr std::size_t peak = 12;
+    sch::Autotuner tuner{{{"in_flight", 40, 4, 64, 2}}};
+    std::uint32_t noise = 1;
+    for (int period = 0; period < 60; ++period) {
+        const double x = tuner[0];
+        noise = noise * 1664525 + 1013904223;
+        const double jitter = (noise >> 16) % 100 / 100. - 0.5;
+        tuner.update(10000 - 10 * (x - peak) * (x - peak) + jitter, false);
+    }
+    const std::size_t found = tuner[0];
+    const bool ok = found + 4 >= peak && found <= peak + 4;
+    fmt::print("Autotuner settled at {} for a peak at {}: {}\n", found, peak, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    const std::string_view mode = argc > 1 ? argv[1] : "sizes";
+    if (mode != "sizes" && mode != "precision" && mode != "autotune") {
+        fmt::print("Usage: {} [sizes|precision|autotune]\n", argv[0]);
+        return 1;
+    }
+    if (mode == "autotune") {
+        return check_autotuner() ? 0 : 1;
+    }
+    setup();
+    if (mode == "sizes") {
+        sweep(std::integer_sequence<int, 4, 8, 10, 12, 16, 24, 32, 48, 64>{});
+    }
+    else {
+        precision(std::integer_sequence<int, 256, 512, 1000>{});
+    }
+    teardown();
+    return 0;
+}
@@ -0,0 +1,91 @@
+// -*-c++-*-
+#ifndef CHASELEVDEQUE_H
+#define CHASELEVDEQUE_H
+// Work-stealing deque (Chase & Lev, with the C11 memory orderings of Le et al., PPoPP 2013).
+// The owner pushes and pops at the bottom; any other thread steals from the top.
+// The buffer does not grow: the capacity must cover everything pushed between two points where
+// the deque is empty, which for the scheduler is the number of nodes in the graph.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+namespace sch {
+template <class T> class ChaseLevDeque {
+    static_assert(std::is_trivially_copyable_v<T>, "ChaseLevDeque holds trivially copyable items");
+
+  private:
+    // top and bottom on separate cache lines: thieves hammer top, the owner bottom
+    alignas(64) std::atomic<std::int64_t> top{0};
+    alignas(64) std::atomic<std::int64_t> bottom{0};
+    std::size_t mask;
+    std::unique_ptr<std::atomic<T>[]> buffer;
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t capacity = 1;
+        while (capacity < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+  public:
+    explicit ChaseLevDeque(std::size_t capacity)
+          : mask(round_up(capacity) - 1), buffer(new std::atomic<T>[mask + 1]) {}
+    ChaseLevDeque(const ChaseLevDeque&) = delete;
+    ChaseLevDeque& operator=(const ChaseLevDeque&) = delete;
+
+    // Owner only
+    void push(T item) {
+        std::int64_t b = bottom.load(std::memory_order_relaxed);
+        buffer[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only
+    std::optional<T> pop() {
+        std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        T item = buffer[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return std::nullopt;
+            }
+        }
+        return item;
+    }
+
+    // Any thread
+    std::optional<T> steal() {
+        std::int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return std::nullopt;
+        }
+        T item = buffer[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+            return std::nullopt; // Lost to the owner or another thief
+        }
+        return item;
+    }
+};
+} // namespace sch
+
+#endif /* CHASELEVDEQUE_H */
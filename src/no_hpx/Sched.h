@@ -1,8 +1,17 @@
 // -*-c++-*-
 #ifndef SCHED_H
 #define SCHED_H
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -15,6 +24,8 @@ namespace ct = boost::callable_traits;
 namespace hana = boost::hana;
 using namespace hana::literals;
 
+#include "ChaseLevDeque.h"
+
 namespace sch {
 template <class Key, class Inputs, class Func> auto Define(Key key, Inputs inputs, Func func) {
     BOOST_HANA_CONSTANT_ASSERT_MSG(hana::is_a<hana::string_tag>(key),
@@ -29,6 +40,13 @@ template <class Key, class Inputs, class Func> auto Define(Key key, Inputs input
 template <class... Defs> class Sched {
   private:
     hana::map<Defs...> definitions;
+    using Keys = decltype(hana::keys(definitions));
+    static constexpr std::size_t n_nodes = hana::length(Keys{});
+
+    template <class Key> static constexpr std::size_t index_of() {
+        using index_t = decltype(hana::index_if(Keys{}, hana::equal.to(Key{})).value());
+        return std::decay_t<index_t>::value;
+    }
 
   public:
     Sched(Defs... defs) : definitions(hana::make_map(defs...)) {}
@@ -75,6 +93,145 @@ template <class... Defs> class Sched {
         hana::for_each(hana::keys(definitions), run_if_required);
         return true;
     }
+
+    // Same as schedule(), but runs independent nodes in parallel on n_workers threads. Each
+    // worker owns a work-stealing deque; a node becomes ready when the atomic count of its
+    // missing inputs drops to zero, and is pushed on the deque of the worker that finished the
+    // last input, so chains stay on one thread unless another one runs out of work. Values are
+    // only printed as they are calculated if verbose, as printing serializes the workers.
+    bool schedule(unsigned n_workers, bool verbose = false) {
+        if (n_workers == 0) {
+            n_workers = 1;
+        }
+        constexpr auto is_required = hana::reverse_partial(hana::at, hana::size_c<3>);
+        std::array<std::function<void()>, n_nodes> run{};
+        std::array<std::vector<std::size_t>, n_nodes> inputs{};
+        std::array<std::vector<std::size_t>, n_nodes> consumers{};
+        std::array<bool, n_nodes> needed{};
+        hana::for_each(hana::keys(definitions), [&](auto key) {
+            constexpr std::size_t k = index_of<decltype(key)>();
+            auto& item = this->definitions[key];
+            // Nodes that were computed by an earlier call are not run again
+            needed[k] = is_required(item) && !hana::at_c<4>(item).has_value();
+            hana::for_each(hana::at_c<1>(item), [&](auto in) {
+                inputs[k].push_back(index_of<decltype(in)>());
+            });
+            run[k] = [this, key, verbose] {
+                auto& item = this->definitions[key];
+                auto input_res = hana::transform(hana::at_c<1>(item), [this](auto in) {
+                    return *hana::at_c<4>(this->definitions[in]);
+                });
+                auto& res = hana::at_c<4>(item);
+                res = hana::unpack(input_res, hana::at_c<2>(item));
+                if (verbose) {
+                    fmt::print("Calculated value of {} to be {}\n", key.c_str(), *res);
+                }
+            };
+        });
+        // Everything upstream of a required node that is not computed yet is needed
+        for (std::size_t pass = 0; pass < n_nodes; ++pass) {
+            hana::for_each(hana::keys(definitions), [&](auto key) {
+                constexpr std::size_t k = index_of<decltype(key)>();
+                if (!needed[k]) {
+                    return;
+                }
+                hana::for_each(hana::at_c<1>(this->definitions[key]), [&](auto in) {
+                    if (!hana::at_c<4>(this->definitions[in]).has_value()) {
+                        needed[index_of<decltype(in)>()] = true;
+                    }
+                });
+            });
+        }
+        std::unique_ptr<std::atomic<int>[]> missing{new std::atomic<int>[n_nodes]};
+        std::size_t n_needed = 0;
+        for (std::size_t k = 0; k < n_nodes; ++k) {
+            missing[k] = 0;
+            if (!needed[k]) {
+                continue;
+            }
+            ++n_needed;
+            for (auto in : inputs[k]) {
+                if (needed[in]) {
+                    ++missing[k];
+                    consumers[in].push_back(k);
+                }
+            }
+        }
+        std::atomic<std::size_t> remaining{n_needed};
+
+        std::vector<std::unique_ptr<ChaseLevDeque<std::size_t>>> deques{};
+        for (unsigned w = 0; w < n_workers; ++w) {
+            deques.push_back(std::make_unique<ChaseLevDeque<std::size_t>>(n_nodes));
+        }
+        // Deal the nodes that are ready from the start among the workers
+        unsigned next_deque = 0;
+        for (std::size_t k = 0; k < n_nodes; ++k) {
+            if (needed[k] && missing[k] == 0) {
+                deques[next_deque++ % n_workers]->push(k);
+            }
+        }
+
+        // Idle workers park instead of spinning through long nodes: a worker that found nothing
+        // to steal max_idle_rounds times in a row sleeps until work is pushed (epoch moves) or
+        // everything is done. Pushers only take the lock when someone may be asleep.
+        constexpr int max_idle_rounds = 64;
+        std::atomic<std::uint64_t> epoch{0};
+        std::atomic<unsigned> sleepers{0};
+        std::mutex park_mtx{};
+        std::condition_variable parked{};
+        auto wake = [&](bool all) {
+            epoch.fetch_add(1);
+            if (sleepers.load() > 0) {
+                // A worker between its check and its wait holds the lock, so it cannot miss this
+                std::lock_guard lock{park_mtx};
+                all ? parked.notify_all() : parked.notify_one();
+            }
+        };
+
+        auto work = [&](unsigned self) {
+            int idle_rounds = 0;
+            while (remaining.load(std::memory_order_acquire) > 0) {
+                const std::uint64_t seen = epoch.load();
+                std::optional<std::size_t> node = deques[self]->pop();
+                for (unsigned i = 1; !node && i < n_workers; ++i) {
+                    node = deques[(self + i) % n_workers]->steal();
+                }
+                if (!node) {
+                    if (++idle_rounds < max_idle_rounds) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    sleepers.fetch_add(1);
+                    std::unique_lock lock{park_mtx};
+                    parked.wait(lock,
+                                [&] { return epoch.load() != seen || remaining.load() == 0; });
+                    sleepers.fetch_sub(1);
+                    idle_rounds = 0;
+                    continue;
+                }
+                idle_rounds = 0;
+                run[*node]();
+                for (auto c : consumers[*node]) {
+                    if (missing[c].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        deques[self]->push(c);
+                        wake(false);
+                    }
+                }
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    wake(true);
+                }
+            }
+        };
+        std::vector<std::thread> workers{};
+        for (unsigned w = 1; w < n_workers; ++w) {
+            workers.emplace_back(work, w);
+        }
+        work(0); // The calling thread is worker 0
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        return true;
+    }
 };
 
 } // namespace sch
@@ -1,6 +1,8 @@
 #include "Sched.h"
 #include <fmt/format.h>
 #include <chrono>
+#include <string>
+#include <string_view>
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -34,7 +36,14 @@ int main(int argc, char* argv[]) {
           sch::Define("Add Squares"_s, hana::make_tuple("Square Plus"_s, "Square Times"_s), plus)};
     auto& final_ans = scheduler.retrieve("Add Squares"_s);
     auto& final_ans2 = scheduler.retrieve("Square Plus"_s);
-    bool success = scheduler.schedule();
+    // With a number of workers, independent nodes run in parallel
+    const int n_workers = argc > 1 ? std::stoi(argv[1]) : 0;
+    const bool verbose = argc > 2 && std::string_view{argv[2]} == "verbose";
+    if (argc > 3 || (argc > 1 && n_workers < 1) || (argc > 2 && !verbose)) {
+        fmt::print("Usage: {} [n_workers [verbose]]\n", argv[0]);
+        return 1;
+    }
+    bool success = argc > 1 ? scheduler.schedule(n_workers, verbose) : scheduler.schedule();
     if (!success) {
         fmt::print("Failed to run!\n");
         return 1;